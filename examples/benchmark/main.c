@@ -0,0 +1,319 @@
+/**
+ * RokoT BLE-MIDI Library - Benchmark Example
+ *
+ * Pushes MIDI through the library as fast as the link accepts it and prints
+ * throughput, queue and latency figures once per second.
+ *
+ * Serial commands:
+ *   n - dense Note On/Off pattern
+ *   c - 14-bit CC stream (CC 1 + CC 33 on channel 0)
+ *   s - 1 KB SysEx dumps
+ *   l - loopback: Note On on channel 16, echoed back by the host
+ *   x - stop sending
+ *   + / - - double / halve the target message rate
+ *   r - reset statistics and latency histogram
+ *
+ * Loopback mode needs the host to echo everything it receives from the
+ * device back to it (e.g. a MIDI thru route in your DAW or a short script).
+ * Round-trip time is measured on-device with time_us_64().
+ *
+ * Boot timing (init, CYW43 firmware, advertising) is printed once the device
+ * is advertising.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "rokot_ble_midi.h"
+
+#define DEVICE_NAME "RokoT Bench"
+#define REPORT_INTERVAL_MS 1000
+#define SYSEX_LEN 1024
+#define LOOPBACK_CHANNEL 15
+
+// Upper limit for '+', well past what a BLE link can carry
+#define TARGET_RATE_MAX 1000000
+
+// 1 ms histogram bins; the last bin collects everything slower
+#define HIST_BINS 64
+
+typedef enum
+{
+  PATTERN_NONE = 0,
+  PATTERN_NOTES,
+  PATTERN_CC14,
+  PATTERN_SYSEX,
+  PATTERN_LOOPBACK,
+} pattern_t;
+
+static const char *pattern_names[] = {"idle", "notes", "cc14", "sysex", "loopback"};
+static const char *profile_names[] = {"balanced", "low-latency", "throughput", "low-memory"};
+
+static pattern_t pattern = PATTERN_NONE;
+static uint32_t target_rate = 1000; // messages per second
+static uint32_t sent_count = 0;
+static uint32_t busy_count = 0;
+
+static uint8_t sysex_buffer[SYSEX_LEN];
+
+// Loopback bookkeeping, indexed by note number
+static uint64_t loopback_sent_us[128];
+static uint32_t hist[HIST_BINS];
+static uint32_t rtt_count = 0;
+static uint64_t rtt_total_us = 0;
+static uint32_t rtt_max_us = 0;
+
+static void midi_rx(uint16_t timestamp, uint8_t status, uint8_t data1, uint8_t data2)
+{
+  (void)timestamp;
+  (void)data2;
+
+  if (status != (MIDI_NOTE_ON | LOOPBACK_CHANNEL) || loopback_sent_us[data1] == 0)
+    return;
+
+  uint32_t rtt = (uint32_t)(time_us_64() - loopback_sent_us[data1]);
+  loopback_sent_us[data1] = 0;
+
+  uint32_t bin = rtt / 1000;
+  if (bin >= HIST_BINS)
+    bin = HIST_BINS - 1;
+  hist[bin]++;
+
+  rtt_count++;
+  rtt_total_us += rtt;
+  if (rtt > rtt_max_us)
+    rtt_max_us = rtt;
+}
+
+static void reset_measurements(void)
+{
+  rokot_ble_midi_reset_stats();
+  rokot_ble_midi_reset_tx_queue_high_water();
+  memset(loopback_sent_us, 0, sizeof(loopback_sent_us));
+  memset(hist, 0, sizeof(hist));
+  rtt_count = 0;
+  rtt_total_us = 0;
+  rtt_max_us = 0;
+  sent_count = 0;
+  busy_count = 0;
+}
+
+static uint32_t hist_percentile(uint32_t percent)
+{
+  uint32_t target = (rtt_count * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint32_t i = 0; i < HIST_BINS; i++)
+  {
+    seen += hist[i];
+    if (seen >= target)
+      return i + 1;
+  }
+  return HIST_BINS;
+}
+
+static void handle_command(int c)
+{
+  switch (c)
+  {
+  case 'n':
+    pattern = PATTERN_NOTES;
+    break;
+  case 'c':
+    pattern = PATTERN_CC14;
+    break;
+  case 's':
+    pattern = PATTERN_SYSEX;
+    break;
+  case 'l':
+    pattern = PATTERN_LOOPBACK;
+    break;
+  case 'x':
+    pattern = PATTERN_NONE;
+    break;
+  case '+':
+    if (target_rate <= TARGET_RATE_MAX / 2)
+      target_rate *= 2;
+    break;
+  case '-':
+    if (target_rate > 1)
+      target_rate /= 2;
+    break;
+  case 'r':
+    reset_measurements();
+    break;
+  default:
+    return;
+  }
+  printf("Pattern: %s, target rate: %lu msg/s\n", pattern_names[pattern], (unsigned long)target_rate);
+}
+
+// Sends one unit of the current pattern; returns false if the library is busy
+static bool send_next(void)
+{
+  static uint8_t note = 0;
+  static uint16_t cc_value = 0;
+  static bool note_is_on = false;
+  int result = 0;
+  uint32_t messages = 1;
+
+  switch (pattern)
+  {
+  case PATTERN_NOTES:
+    if (note_is_on)
+      result = rokot_ble_midi_note_off(0, note);
+    else
+      result = rokot_ble_midi_note_on(0, note, 100);
+    if (result == 0)
+    {
+      if (note_is_on)
+        note = (uint8_t)((note + 1) & 0x7F);
+      note_is_on = !note_is_on;
+    }
+    break;
+
+  case PATTERN_CC14:
+    // MSB and LSB are queued as one batch and share a notification
+    result = rokot_ble_midi_control_change_14bit(0, MIDI_CC_MOD_WHEEL, cc_value);
+    if (result == 0)
+      cc_value = (uint16_t)((cc_value + 64) & 0x3FFF);
+    messages = 2;
+    break;
+
+  case PATTERN_SYSEX:
+    if (rokot_ble_midi_is_sysex_busy())
+      return false;
+    result = rokot_ble_midi_send_sysex(sysex_buffer, sizeof(sysex_buffer));
+    break;
+
+  case PATTERN_LOOPBACK:
+    // Overwrites a probe on the same note that never came back
+    loopback_sent_us[note] = time_us_64();
+    result = rokot_ble_midi_note_on(LOOPBACK_CHANNEL, note, 1);
+    if (result == 0)
+      note = (uint8_t)((note + 1) & 0x7F);
+    else
+      loopback_sent_us[note] = 0;
+    break;
+
+  default:
+    return false;
+  }
+
+  if (result != 0)
+  {
+    busy_count++;
+    return false;
+  }
+  sent_count += messages;
+  return true;
+}
+
+static void print_report(uint32_t elapsed_ms)
+{
+  rokot_ble_midi_stats_t stats;
+  rokot_ble_midi_get_stats(&stats);
+
+  printf("[%s] sent %lu/s busy %lu | notif %lu msgs %lu coal %lu coll %lu drop %lu | lat avg %lu max %lu us | "
+         "q hw %u | ci %.2f ms mtu %u dle %u\n",
+         pattern_names[pattern],
+         (unsigned long)(sent_count * 1000 / elapsed_ms), (unsigned long)busy_count,
+         (unsigned long)stats.tx_notifications, (unsigned long)stats.tx_messages,
+         (unsigned long)stats.tx_coalesced, (unsigned long)stats.tx_collapsed, (unsigned long)stats.tx_dropped,
+         (unsigned long)stats.tx_latency_avg_us, (unsigned long)stats.tx_latency_max_us,
+         rokot_ble_midi_get_tx_queue_high_water(),
+         rokot_ble_midi_get_connection_interval(), rokot_ble_midi_get_mtu(), rokot_ble_midi_get_data_length());
+
+  if (pattern == PATTERN_LOOPBACK && rtt_count > 0)
+  {
+    printf("  rtt n=%lu avg %lu us max %lu us | p50 <%lu ms p90 <%lu ms p99 <%lu ms\n",
+           (unsigned long)rtt_count, (unsigned long)(rtt_total_us / rtt_count), (unsigned long)rtt_max_us,
+           (unsigned long)hist_percentile(50), (unsigned long)hist_percentile(90),
+           (unsigned long)hist_percentile(99));
+  }
+
+  sent_count = 0;
+  busy_count = 0;
+}
+
+int main()
+{
+  stdio_init_all();
+  sleep_ms(1000);
+
+  printf("=================================\n");
+  printf("RokoT BLE-MIDI Benchmark\n");
+  printf("=================================\n\n");
+
+  sysex_buffer[0] = 0xF0;
+  for (int i = 1; i < SYSEX_LEN - 1; i++)
+    sysex_buffer[i] = (uint8_t)(i & 0x7F);
+  sysex_buffer[SYSEX_LEN - 1] = 0xF7;
+
+  if (rokot_ble_midi_init(DEVICE_NAME) != 0)
+  {
+    printf("ERROR: BLE-MIDI initialization failed!\n");
+    while (1)
+    {
+      tight_loop_contents();
+    }
+  }
+  rokot_ble_midi_set_timestamped_callback(midi_rx);
+
+  printf("Device name: %s\n", DEVICE_NAME);
+  printf("TX queue: %d entries\n", ROKOT_BLE_MIDI_TX_QUEUE_LEN);
+  printf("Buffer profile: %s, SPI clock divider %d\n", profile_names[ROKOT_BLE_MIDI_PROFILE], ROKOT_BLE_MIDI_SPI_CLK_DIV);
+
+  rokot_ble_midi_ram_usage_t ram;
+  rokot_ble_midi_get_ram_usage(&ram);
+  printf("Library RAM: %lu bytes (tx %lu, rx %lu, connections %lu, other %lu) + BTstack host ACL %lu\n",
+      (unsigned long)ram.total, (unsigned long)ram.tx, (unsigned long)ram.rx, (unsigned long)ram.connections,
+      (unsigned long)ram.other, (unsigned long)ram.btstack_host_acl);
+  printf("Commands: n c s l x + - r\n\n");
+
+  uint64_t next_send_us = time_us_64();
+  uint32_t last_report = to_ms_since_boot(get_absolute_time());
+  bool boot_reported = false;
+
+  while (true)
+  {
+    rokot_ble_midi_poll();
+
+    if (!boot_reported)
+    {
+      rokot_ble_midi_boot_stats_t boot;
+      rokot_ble_midi_get_boot_stats(&boot);
+      if (boot.advertising_us)
+      {
+        printf("Boot: init at %lu us, then CYW43 +%lu us, HCI up +%lu us, advertising +%lu us\n",
+            (unsigned long)boot.init_us, (unsigned long)(boot.cyw43_ready_us - boot.init_us),
+            (unsigned long)(boot.hci_working_us - boot.init_us), (unsigned long)(boot.advertising_us - boot.init_us));
+        boot_reported = true;
+      }
+    }
+
+    int c = getchar_timeout_us(0);
+    if (c != PICO_ERROR_TIMEOUT)
+      handle_command(c);
+
+    if (rokot_ble_midi_is_ready() && pattern != PATTERN_NONE)
+    {
+      // Pace to the target rate; skip ahead rather than bursting after a stall
+      uint64_t now = time_us_64();
+      uint64_t period = 1000000 / target_rate;
+      if (now > next_send_us + 100000)
+        next_send_us = now;
+      while (next_send_us <= now && send_next())
+        next_send_us += period;
+    }
+
+    uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+    if (now_ms - last_report >= REPORT_INTERVAL_MS)
+    {
+      if (rokot_ble_midi_is_ready())
+        print_report(now_ms - last_report);
+      last_report = now_ms;
+    }
+  }
+
+  return 0;
+}
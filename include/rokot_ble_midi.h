@@ -6,6 +6,7 @@
 #ifndef ROKOT_BLE_MIDI_H
 #define ROKOT_BLE_MIDI_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -21,6 +22,17 @@ extern "C" {
 #define ROKOT_BLE_MIDI_SPI_CLK_DIV 3
 #endif
 
+// BTstack buffer profile, selected with ROKOT_BLE_MIDI_PROFILE in CMake; the
+// buffer counts each one sets are in src/btstack_config.h
+#define ROKOT_BLE_MIDI_PROFILE_BALANCED 0
+#define ROKOT_BLE_MIDI_PROFILE_LOW_LATENCY 1
+#define ROKOT_BLE_MIDI_PROFILE_THROUGHPUT 2
+#define ROKOT_BLE_MIDI_PROFILE_LOW_MEMORY 3
+
+#ifndef ROKOT_BLE_MIDI_PROFILE
+#define ROKOT_BLE_MIDI_PROFILE ROKOT_BLE_MIDI_PROFILE_BALANCED
+#endif
+
 #ifndef ROKOT_BLE_MIDI_CONN_INTERVAL_MIN
 #define ROKOT_BLE_MIDI_CONN_INTERVAL_MIN 6
 #endif
@@ -29,6 +41,201 @@ extern "C" {
 #define ROKOT_BLE_MIDI_CONN_INTERVAL_MAX 12
 #endif
 
+// Supervision timeout in 10 ms units, used for every parameter request
+#ifndef ROKOT_BLE_MIDI_SUPERVISION_TIMEOUT
+#define ROKOT_BLE_MIDI_SUPERVISION_TIMEOUT 100
+#endif
+
+// Idle connection policy (see rokot_ble_midi_set_conn_policy()). After
+// IDLE_TIMEOUT_MS without MIDI the idle interval (1.25 ms units) and
+// peripheral latency are requested; 0 keeps the fast parameters always.
+#ifndef ROKOT_BLE_MIDI_IDLE_TIMEOUT_MS
+#define ROKOT_BLE_MIDI_IDLE_TIMEOUT_MS 0
+#endif
+
+#ifndef ROKOT_BLE_MIDI_IDLE_INTERVAL_MIN
+#define ROKOT_BLE_MIDI_IDLE_INTERVAL_MIN 24
+#endif
+
+#ifndef ROKOT_BLE_MIDI_IDLE_INTERVAL_MAX
+#define ROKOT_BLE_MIDI_IDLE_INTERVAL_MAX 40
+#endif
+
+#ifndef ROKOT_BLE_MIDI_IDLE_LATENCY
+#define ROKOT_BLE_MIDI_IDLE_LATENCY 4
+#endif
+
+// Hold each send request until this many microseconds before the peer's
+// next predicted connection event, coalescing what is queued meanwhile;
+// 0 requests the send slot as soon as a message is queued
+#ifndef ROKOT_BLE_MIDI_LATE_FLUSH_US
+#define ROKOT_BLE_MIDI_LATE_FLUSH_US 0
+#endif
+
+// ATT MTU requested on connect. 247 lets one notification fill a single
+// 251-byte LE Data Length Extension PDU.
+#ifndef ROKOT_BLE_MIDI_ATT_MTU
+#define ROKOT_BLE_MIDI_ATT_MTU 247
+#endif
+
+#ifndef ROKOT_BLE_MIDI_LE_DATA_LENGTH
+#define ROKOT_BLE_MIDI_LE_DATA_LENGTH 251
+#endif
+
+#ifndef ROKOT_BLE_MIDI_LE_DATA_LENGTH_TIME
+#define ROKOT_BLE_MIDI_LE_DATA_LENGTH_TIME 2120
+#endif
+
+// Ask for the LE 2M PHY after connecting; centrals without it stay on 1M.
+// Set to 0 to keep every link on 1M, which has the longer range.
+#ifndef ROKOT_BLE_MIDI_LE_2M_PHY
+#define ROKOT_BLE_MIDI_LE_2M_PHY 1
+#endif
+
+// Store pairing keys in flash so bonded centrals reconnect without pairing
+// again. Set to 0 to accept connections without bonding.
+#ifndef ROKOT_BLE_MIDI_BONDING
+#define ROKOT_BLE_MIDI_BONDING 1
+#endif
+
+// Advertising intervals in 0.625 ms units. The fast interval is used after
+// boot and disconnects for ADV_FAST_TIMEOUT_MS (0 = always), then the slow one.
+#ifndef ROKOT_BLE_MIDI_ADV_FAST_INTERVAL_MIN
+#define ROKOT_BLE_MIDI_ADV_FAST_INTERVAL_MIN 0x0020
+#endif
+
+#ifndef ROKOT_BLE_MIDI_ADV_FAST_INTERVAL_MAX
+#define ROKOT_BLE_MIDI_ADV_FAST_INTERVAL_MAX 0x0040
+#endif
+
+#ifndef ROKOT_BLE_MIDI_ADV_FAST_TIMEOUT_MS
+#define ROKOT_BLE_MIDI_ADV_FAST_TIMEOUT_MS 30000
+#endif
+
+#ifndef ROKOT_BLE_MIDI_ADV_SLOW_INTERVAL_MIN
+#define ROKOT_BLE_MIDI_ADV_SLOW_INTERVAL_MIN 0x0190
+#endif
+
+#ifndef ROKOT_BLE_MIDI_ADV_SLOW_INTERVAL_MAX
+#define ROKOT_BLE_MIDI_ADV_SLOW_INTERVAL_MAX 0x01E0
+#endif
+
+// Advertise directly at a bonded central after its link timed out
+#ifndef ROKOT_BLE_MIDI_ADV_DIRECTED
+#define ROKOT_BLE_MIDI_ADV_DIRECTED 1
+#endif
+
+// Keep the per-message send path (API call to queue) in RAM so a scan loop
+// does not take XIP cache misses on it. Set to 0 to leave it in flash.
+#ifndef ROKOT_BLE_MIDI_SEND_IN_RAM
+#define ROKOT_BLE_MIDI_SEND_IN_RAM 1
+#endif
+
+// Centrals that can be connected at once. Every message is sent to each peer
+// that has subscribed to notifications.
+#ifndef ROKOT_BLE_MIDI_MAX_CONNECTIONS
+#define ROKOT_BLE_MIDI_MAX_CONNECTIONS 1
+#endif
+
+// Set to 1 (ROKOT_BLE_MIDI_CENTRAL in CMakeLists.txt) to also act as a
+// central that connects to one BLE-MIDI peripheral and receives from it
+#ifndef ROKOT_BLE_MIDI_CENTRAL
+#define ROKOT_BLE_MIDI_CENTRAL 0
+#endif
+
+// Set to 1 (ROKOT_BLE_MIDI_USB in CMakeLists.txt) to bridge a TinyUSB MIDI
+// device to BLE-MIDI in both directions
+#ifndef ROKOT_BLE_MIDI_USB
+#define ROKOT_BLE_MIDI_USB 0
+#endif
+
+// Longest SysEx (without F0/F7) forwarded from USB to BLE
+#ifndef ROKOT_BLE_MIDI_USB_SYSEX_LEN
+#define ROKOT_BLE_MIDI_USB_SYSEX_LEN 256
+#endif
+
+// Depth of the outgoing message queue shared by all send functions
+#ifndef ROKOT_BLE_MIDI_TX_QUEUE_LEN
+#define ROKOT_BLE_MIDI_TX_QUEUE_LEN 32
+#endif
+
+// Omit repeated channel status bytes within a notification (BLE-MIDI running
+// status). Set to 0 for receivers that mishandle it.
+#ifndef ROKOT_BLE_MIDI_RUNNING_STATUS
+#define ROKOT_BLE_MIDI_RUNNING_STATUS 1
+#endif
+
+// Set to 1 when linking pico_cyw43_arch_threadsafe_background (see
+// ROKOT_BLE_MIDI_BACKGROUND in CMakeLists.txt); BTstack then runs from a
+// background IRQ and rokot_ble_midi_task()/poll() have nothing to do
+#ifndef ROKOT_BLE_MIDI_BACKGROUND
+#define ROKOT_BLE_MIDI_BACKGROUND 0
+#endif
+
+// Set to 1 (ROKOT_BLE_MIDI_MULTICORE in CMakeLists.txt) to run BTstack on
+// core 1; send functions then push into a lock-free ring and receive
+// callbacks are delivered on core 0 from rokot_ble_midi_task()/poll()
+#ifndef ROKOT_BLE_MIDI_MULTICORE
+#define ROKOT_BLE_MIDI_MULTICORE 0
+#endif
+
+// Set to 1 (ROKOT_BLE_MIDI_ASYNC_INIT in CMakeLists.txt) to return from
+// rokot_ble_midi_init() before the CYW43 firmware is loaded, which then
+// happens on core 1 while the application runs. Requires
+// ROKOT_BLE_MIDI_MULTICORE.
+#ifndef ROKOT_BLE_MIDI_ASYNC_INIT
+#define ROKOT_BLE_MIDI_ASYNC_INIT 0
+#endif
+
+// Set to 1 (ROKOT_BLE_MIDI_RX_DEFERRED in CMakeLists.txt) to queue received
+// messages and deliver them from rokot_ble_midi_task()/poll() instead of
+// from BTstack context. Always the case in dual-core mode.
+#ifndef ROKOT_BLE_MIDI_RX_DEFERRED
+#define ROKOT_BLE_MIDI_RX_DEFERRED 0
+#endif
+
+// Depth of the ring carrying received messages to rokot_ble_midi_task()
+// in deferred or dual-core mode
+#ifndef ROKOT_BLE_MIDI_RX_QUEUE_LEN
+#define ROKOT_BLE_MIDI_RX_QUEUE_LEN 32
+#endif
+
+// Bytes of ring for deferred raw receive (rokot_ble_midi_set_raw_callback());
+// 0 leaves only delivery in place
+#ifndef ROKOT_BLE_MIDI_RAW_RX_BUFFER
+#define ROKOT_BLE_MIDI_RAW_RX_BUFFER 0
+#endif
+
+// Set to 0 to compile the statistics counters out of the hot path
+#ifndef ROKOT_BLE_MIDI_ENABLE_STATS
+#define ROKOT_BLE_MIDI_ENABLE_STATS 1
+#endif
+
+// Optional GATT services and LE Secure Connections (set to 0 to compile them
+// out). Without DIS the manufacturer and firmware setters do nothing; without
+// Battery the level is kept for rokot_ble_midi_get_battery_level() only.
+#ifndef ROKOT_BLE_MIDI_DIS
+#define ROKOT_BLE_MIDI_DIS 1
+#endif
+
+#ifndef ROKOT_BLE_MIDI_BATTERY
+#define ROKOT_BLE_MIDI_BATTERY 1
+#endif
+
+#ifndef ROKOT_BLE_MIDI_SECURE_CONNECTIONS
+#define ROKOT_BLE_MIDI_SECURE_CONNECTIONS 1
+#endif
+
+// Vendor telemetry service with one notify characteristic of up to
+// ROKOT_BLE_MIDI_TELEMETRY_SIZE bytes, see rokot_ble_midi_set_telemetry()
+#ifndef ROKOT_BLE_MIDI_TELEMETRY
+#define ROKOT_BLE_MIDI_TELEMETRY 0
+#endif
+
+#ifndef ROKOT_BLE_MIDI_TELEMETRY_SIZE
+#define ROKOT_BLE_MIDI_TELEMETRY_SIZE 20
+#endif
+
 // Device Information Defaults
 #ifndef ROKOT_BLE_MIDI_MANUFACTURER
 #define ROKOT_BLE_MIDI_MANUFACTURER "RokoT"
@@ -38,12 +245,78 @@ extern "C" {
 #define ROKOT_BLE_MIDI_FIRMWARE_VERSION "1.0.0"
 #endif
 
+// Storage for the Device Information strings, terminator included
+#ifndef ROKOT_BLE_MIDI_MANUFACTURER_SIZE
+#define ROKOT_BLE_MIDI_MANUFACTURER_SIZE 32
+#endif
+
+#ifndef ROKOT_BLE_MIDI_FIRMWARE_VERSION_SIZE
+#define ROKOT_BLE_MIDI_FIRMWARE_VERSION_SIZE 16
+#endif
+
 // ---------------------------------------------------------------------------
 // Types
 // ---------------------------------------------------------------------------
 
 typedef void (*rokot_ble_midi_callback_t)(uint8_t status, uint8_t data1, uint8_t data2);
 
+// timestamp is the sender's 13-bit BLE-MIDI timestamp in milliseconds
+typedef void (*rokot_ble_midi_timestamped_callback_t)(uint16_t timestamp, uint8_t status,
+                                                      uint8_t data1, uint8_t data2);
+
+// Incoming BLE-MIDI packet as written by the peer, header byte included.
+// packet is only valid until the callback returns; arrival_us is time_us_32().
+typedef void (*rokot_ble_midi_raw_callback_t)(uint16_t con_handle, const uint8_t *packet, uint16_t len,
+                                              uint32_t arrival_us);
+
+// data holds the complete message from 0xF0 to 0xF7; truncated is set if it
+// did not fit the buffer passed to rokot_ble_midi_set_sysex_callback()
+typedef void (*rokot_ble_midi_sysex_callback_t)(const uint8_t *data, size_t len, bool truncated);
+
+// One MIDI message for rokot_ble_midi_send_batch(); unused data bytes are ignored
+typedef struct {
+  uint8_t status;
+  uint8_t data1;
+  uint8_t data2;
+} rokot_midi_msg_t;
+
+typedef struct {
+  uint32_t tx_messages;        // Messages (a SysEx counts once) accepted by BTstack
+  uint32_t tx_dropped;         // Send calls rejected with -2 (queue full)
+  uint32_t tx_coalesced;       // Messages that shared a notification with an earlier one
+  uint32_t tx_collapsed;       // Messages that overwrote a pending value (see set_collapse)
+  uint32_t tx_notifications;   // BLE-MIDI notifications sent
+  uint32_t tx_latency_max_us;  // Longest enqueue-to-notify time
+  uint32_t tx_latency_avg_us;  // Mean enqueue-to-notify time
+  uint32_t rx_messages;        // Messages decoded from incoming writes
+  uint32_t rx_parse_errors;    // Malformed packets, orphan data bytes, aborted messages
+  uint32_t rx_dropped;         // Messages lost because the receive queue was full
+  uint32_t rx_raw_dropped;     // Packets lost because the deferred raw ring was full
+  uint32_t reconnects;         // Connections after the first one since boot
+  uint32_t reconnect_time_last_ms;  // Disconnect to next subscribe, latest
+  uint32_t reconnect_time_max_ms;   // Disconnect to next subscribe, longest
+} rokot_ble_midi_stats_t;
+
+// Boot milestones as time_us_32(), microseconds since power-on; 0 until reached
+typedef struct {
+  uint32_t init_us;            // rokot_ble_midi_init() called
+  uint32_t cyw43_ready_us;     // CYW43 driver initialised, firmware not yet loaded
+  uint32_t hci_working_us;     // Firmware loaded and the controller up
+  uint32_t advertising_us;     // Controller accepted the first advertising enable
+} rokot_ble_midi_boot_stats_t;
+
+// Called once per rokot_ble_midi_init() when advertising has started, in
+// BTstack context (core 1 in dual-core mode)
+typedef void (*rokot_ble_midi_advertising_callback_t)(void);
+
+// Connection parameters requested while idle; intervals in 1.25 ms units
+typedef struct {
+  uint32_t idle_timeout_ms;    // Time without MIDI before going idle, 0 = never
+  uint16_t idle_interval_min;
+  uint16_t idle_interval_max;
+  uint16_t idle_latency;       // Connection events the device may skip
+} rokot_ble_midi_conn_policy_t;
+
 typedef enum {
   ROKOT_BLE_MIDI_DISCONNECTED = 0,
   ROKOT_BLE_MIDI_CONNECTED,
@@ -62,6 +335,7 @@ void rokot_ble_midi_deinit(void);
 // ---------------------------------------------------------------------------
 
 void rokot_ble_midi_task(void);
+void rokot_ble_midi_poll(void);
 
 // ---------------------------------------------------------------------------
 // Status
@@ -70,7 +344,17 @@ void rokot_ble_midi_task(void);
 rokot_ble_midi_state_t rokot_ble_midi_get_state(void);
 bool rokot_ble_midi_is_ready(void);
 bool rokot_ble_midi_is_connected(void);
+uint8_t rokot_ble_midi_get_connection_count(void);
 float rokot_ble_midi_get_connection_interval(void);
+uint16_t rokot_ble_midi_get_peripheral_latency(void);
+float rokot_ble_midi_get_effective_latency(void);
+int32_t rokot_ble_midi_get_time_to_next_event_us(void);
+uint16_t rokot_ble_midi_get_mtu(void);
+uint16_t rokot_ble_midi_get_data_length(void);
+uint8_t rokot_ble_midi_get_phy(void);
+
+void rokot_ble_midi_set_conn_policy(const rokot_ble_midi_conn_policy_t *policy);
+void rokot_ble_midi_get_conn_policy(rokot_ble_midi_conn_policy_t *policy);
 
 // ---------------------------------------------------------------------------
 // Device Information
@@ -83,26 +367,138 @@ void rokot_ble_midi_set_firmware_version(const char *version);
 // Battery Service
 // ---------------------------------------------------------------------------
 
+// Notifications for the battery level and telemetry are low priority: they
+// only go out once no MIDI is waiting, and only the latest value is sent
 void rokot_ble_midi_set_battery_level(uint8_t level);
 uint8_t rokot_ble_midi_get_battery_level(void);
 
+// ---------------------------------------------------------------------------
+// Telemetry
+// ---------------------------------------------------------------------------
+
+// Copies up to ROKOT_BLE_MIDI_TELEMETRY_SIZE bytes; -1 if longer or
+// ROKOT_BLE_MIDI_TELEMETRY is 0
+int rokot_ble_midi_set_telemetry(const uint8_t *data, uint16_t len);
+
 // ---------------------------------------------------------------------------
 // Sending MIDI Messages
 // ---------------------------------------------------------------------------
 
-int rokot_ble_midi_note_on(uint8_t channel, uint8_t note, uint8_t velocity);
-int rokot_ble_midi_note_off(uint8_t channel, uint8_t note);
-int rokot_ble_midi_control_change(uint8_t channel, uint8_t controller, uint8_t value);
-int rokot_ble_midi_program_change(uint8_t channel, uint8_t program);
-int rokot_ble_midi_pitch_bend(uint8_t channel, int16_t value);
-int rokot_ble_midi_channel_pressure(uint8_t channel, uint8_t pressure);
+// Any channel voice message (status 0x80-0xEF); the note_on() style senders
+// are static inline wrappers around it, see Inline Senders below
+int rokot_ble_midi_send_message(uint8_t status, uint8_t data1, uint8_t data2);
 int rokot_ble_midi_send_raw(const uint8_t *data, uint8_t len);
 
+// Queues up to ROKOT_BLE_MIDI_BATCH_MAX messages, all or nothing: -2 if they
+// do not fit right now, -1 if n is larger than the queue can ever hold. The
+// dual-core ring keeps one slot free, so it holds one message fewer.
+#if ROKOT_BLE_MIDI_MULTICORE
+#define ROKOT_BLE_MIDI_BATCH_MAX (ROKOT_BLE_MIDI_TX_QUEUE_LEN - 1)
+#else
+#define ROKOT_BLE_MIDI_BATCH_MAX ROKOT_BLE_MIDI_TX_QUEUE_LEN
+#endif
+int rokot_ble_midi_send_batch(const rokot_midi_msg_t *msgs, size_t n);
+
+// Multi-message sequences, each queued atomically in one notification.
+// 14-bit values are 0-16383; controller is the MSB controller (0-31).
+int rokot_ble_midi_control_change_14bit(uint8_t channel, uint8_t controller, uint16_t value);
+int rokot_ble_midi_rpn(uint8_t channel, uint16_t parameter, uint16_t value);
+int rokot_ble_midi_nrpn(uint8_t channel, uint16_t parameter, uint16_t value);
+int rokot_ble_midi_mpe_configure(uint8_t manager_channel, uint8_t member_channels);
+int rokot_ble_midi_mpe_note_on(uint8_t channel, uint8_t note, uint8_t velocity,
+                               int16_t pitch_bend, uint8_t timbre, uint8_t pressure);
+
+// ---------------------------------------------------------------------------
+// SysEx
+// ---------------------------------------------------------------------------
+
+// data must hold a complete 0xF0 ... 0xF7 message and stay valid until
+// rokot_ble_midi_is_sysex_busy() returns false; it is not copied
+int rokot_ble_midi_send_sysex(const uint8_t *data, size_t len);
+bool rokot_ble_midi_is_sysex_busy(void);
+void rokot_ble_midi_set_sysex_callback(uint8_t *buffer, size_t size, rokot_ble_midi_sysex_callback_t callback);
+
+// ---------------------------------------------------------------------------
+// Transmit Queue
+// ---------------------------------------------------------------------------
+
+uint16_t rokot_ble_midi_get_tx_queue_free(void);
+uint16_t rokot_ble_midi_get_tx_queue_high_water(void);
+void rokot_ble_midi_reset_tx_queue_high_water(void);
+
+// Message types whose pending value is overwritten in place by a newer one
+// instead of queuing both; none by default
+#define ROKOT_BLE_MIDI_COLLAPSE_CONTROL_CHANGE 0x01
+#define ROKOT_BLE_MIDI_COLLAPSE_PITCH_BEND 0x02
+#define ROKOT_BLE_MIDI_COLLAPSE_CHANNEL_PRESSURE 0x04
+#define ROKOT_BLE_MIDI_COLLAPSE_POLY_PRESSURE 0x08
+
+void rokot_ble_midi_set_collapse(uint8_t types);
+
+// ---------------------------------------------------------------------------
+// MIDI Clock
+// ---------------------------------------------------------------------------
+
+// Send Start/Continue, then 24 PPQN clock at bpm until stopped
+int rokot_ble_midi_clock_start(float bpm);
+int rokot_ble_midi_clock_continue(float bpm);
+void rokot_ble_midi_clock_stop(void);
+void rokot_ble_midi_clock_set_tempo(float bpm);
+bool rokot_ble_midi_clock_is_running(void);
+
+// Tempo of the received clock in BPM, 0 if none in the last second
+float rokot_ble_midi_get_rx_tempo(void);
+
+// ---------------------------------------------------------------------------
+// Statistics
+// ---------------------------------------------------------------------------
+
+void rokot_ble_midi_get_stats(rokot_ble_midi_stats_t *stats);
+void rokot_ble_midi_reset_stats(void);
+
+// Boot timing is always recorded, independent of ROKOT_BLE_MIDI_ENABLE_STATS
+void rokot_ble_midi_get_boot_stats(rokot_ble_midi_boot_stats_t *stats);
+void rokot_ble_midi_set_advertising_callback(rokot_ble_midi_advertising_callback_t callback);
+
+// ---------------------------------------------------------------------------
+// Memory Usage
+// ---------------------------------------------------------------------------
+
+// Static RAM held by the library for the current configuration, in bytes.
+// The SysEx receive buffer is the caller's and not included.
+typedef struct {
+  uint32_t tx;               // transmit queue, packet buffer, dual-core ring
+  uint32_t rx;               // receive queue, raw ring, decoder state
+  uint32_t connections;      // per-connection and device state
+  uint32_t other;            // statistics, clock, advertising, USB bridge
+  uint32_t total;            // sum of the above
+  uint32_t btstack_host_acl; // BTstack's host ACL buffers (ROKOT_BLE_MIDI_PROFILE)
+} rokot_ble_midi_ram_usage_t;
+
+void rokot_ble_midi_get_ram_usage(rokot_ble_midi_ram_usage_t *usage);
+
 // ---------------------------------------------------------------------------
 // Receiving MIDI Messages
 // ---------------------------------------------------------------------------
 
 void rokot_ble_midi_set_callback(rokot_ble_midi_callback_t callback);
+void rokot_ble_midi_set_timestamped_callback(rokot_ble_midi_timestamped_callback_t callback);
+int rokot_ble_midi_set_raw_callback(rokot_ble_midi_raw_callback_t callback, bool deferred);
+
+#if ROKOT_BLE_MIDI_CENTRAL
+// ---------------------------------------------------------------------------
+// Central Role
+// ---------------------------------------------------------------------------
+
+// Raw BLE-MIDI packet notified by the peripheral, header byte included.
+// Return true to consume it; false passes it on to the receive callbacks.
+typedef bool (*rokot_ble_midi_packet_callback_t)(const uint8_t *packet, uint16_t len);
+
+int rokot_ble_midi_central_start(void);
+void rokot_ble_midi_central_stop(void);
+bool rokot_ble_midi_central_is_connected(void);
+void rokot_ble_midi_set_central_packet_callback(rokot_ble_midi_packet_callback_t callback);
+#endif
 
 // ---------------------------------------------------------------------------
 // MIDI Constants
@@ -122,6 +518,13 @@ void rokot_ble_midi_set_callback(rokot_ble_midi_callback_t callback);
 #define MIDI_CC_PAN 10
 #define MIDI_CC_EXPRESSION 11
 #define MIDI_CC_SUSTAIN 64
+#define MIDI_CC_DATA_ENTRY_MSB 6
+#define MIDI_CC_DATA_ENTRY_LSB 38
+#define MIDI_CC_MPE_TIMBRE 74
+#define MIDI_CC_NRPN_LSB 98
+#define MIDI_CC_NRPN_MSB 99
+#define MIDI_CC_RPN_LSB 100
+#define MIDI_CC_RPN_MSB 101
 #define MIDI_CC_ALL_NOTES_OFF 123
 
 #define MIDI_NOTE_C4 60
@@ -137,6 +540,44 @@ void rokot_ble_midi_set_callback(rokot_ble_midi_callback_t callback);
 #define MIDI_NOTE_AS4 70
 #define MIDI_NOTE_B4 71
 
+// ---------------------------------------------------------------------------
+// Inline Senders
+// ---------------------------------------------------------------------------
+
+// With a constant channel the status byte folds to a constant, leaving a
+// single call per message
+
+static inline int rokot_ble_midi_note_on(uint8_t channel, uint8_t note, uint8_t velocity) {
+  return rokot_ble_midi_send_message((uint8_t)(MIDI_NOTE_ON | (channel & 0x0F)), note & 0x7F, velocity & 0x7F);
+}
+
+static inline int rokot_ble_midi_note_off(uint8_t channel, uint8_t note) {
+  return rokot_ble_midi_send_message((uint8_t)(MIDI_NOTE_OFF | (channel & 0x0F)), note & 0x7F, 0);
+}
+
+static inline int rokot_ble_midi_control_change(uint8_t channel, uint8_t controller, uint8_t value) {
+  return rokot_ble_midi_send_message((uint8_t)(MIDI_CONTROL_CHANGE | (channel & 0x0F)), controller & 0x7F, value & 0x7F);
+}
+
+static inline int rokot_ble_midi_program_change(uint8_t channel, uint8_t program) {
+  return rokot_ble_midi_send_message((uint8_t)(MIDI_PROGRAM_CHANGE | (channel & 0x0F)), program & 0x7F, 0);
+}
+
+// value is -8192 to +8191
+static inline int rokot_ble_midi_pitch_bend(uint8_t channel, int16_t value) {
+  uint16_t bend = (uint16_t)(value + 8192);
+  return rokot_ble_midi_send_message((uint8_t)(MIDI_PITCH_BEND | (channel & 0x0F)),
+                                     (uint8_t)(bend & 0x7F), (uint8_t)((bend >> 7) & 0x7F));
+}
+
+static inline int rokot_ble_midi_channel_pressure(uint8_t channel, uint8_t pressure) {
+  return rokot_ble_midi_send_message((uint8_t)(MIDI_CHANNEL_PRESSURE | (channel & 0x0F)), pressure & 0x7F, 0);
+}
+
+static inline int rokot_ble_midi_poly_pressure(uint8_t channel, uint8_t note, uint8_t pressure) {
+  return rokot_ble_midi_send_message((uint8_t)(MIDI_POLY_PRESSURE | (channel & 0x0F)), note & 0x7F, pressure & 0x7F);
+}
+
 #ifdef __cplusplus
 }
 #endif
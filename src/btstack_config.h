@@ -5,10 +5,63 @@
 // RokoT BLE-MIDI BTstack Configuration
 // ---------------------------------------------------------------------------
 
+// Library settings the limits below depend on (see rokot_ble_midi.h)
+#ifndef ROKOT_BLE_MIDI_MAX_CONNECTIONS
+#define ROKOT_BLE_MIDI_MAX_CONNECTIONS 1
+#endif
+#ifndef ROKOT_BLE_MIDI_CENTRAL
+#define ROKOT_BLE_MIDI_CENTRAL 0
+#endif
+#ifndef ROKOT_BLE_MIDI_PROFILE
+#define ROKOT_BLE_MIDI_PROFILE 0
+#endif
+#ifndef ROKOT_BLE_MIDI_SECURE_CONNECTIONS
+#define ROKOT_BLE_MIDI_SECURE_CONNECTIONS 1
+#endif
+
+// Buffer profiles (ROKOT_BLE_MIDI_PROFILE):
+//   0 BALANCED     3 controller / 3 host ACL buffers, as tested with Radio
+//                  Module 2 at 50 MHz
+//   1 LOW_LATENCY  2 controller buffers: fewer notifications in flight, so a
+//                  new message never waits behind more than one
+//   2 THROUGHPUT   6 / 6: more notifications per connection event for dense
+//                  streams and SysEx; needs a bus fast enough to drain them
+//   3 LOW_MEMORY   2 / 2: one host buffer (HCI_HOST_ACL_PACKET_LEN) less
+// Each host buffer is HCI_HOST_ACL_PACKET_LEN bytes of RAM; controller
+// buffers only bound how many packets are handed to the CYW43 at once.
+// ROKOT_BLE_MIDI_ACL_BUFFERS and ROKOT_BLE_MIDI_HOST_ACL_PACKETS override the
+// counts individually.
+#if ROKOT_BLE_MIDI_PROFILE == 1
+#define BLE_MIDI_PROFILE_ACL_BUFFERS 2
+#define BLE_MIDI_PROFILE_HOST_ACL_PACKETS 3
+#elif ROKOT_BLE_MIDI_PROFILE == 2
+#define BLE_MIDI_PROFILE_ACL_BUFFERS 6
+#define BLE_MIDI_PROFILE_HOST_ACL_PACKETS 6
+#elif ROKOT_BLE_MIDI_PROFILE == 3
+#define BLE_MIDI_PROFILE_ACL_BUFFERS 2
+#define BLE_MIDI_PROFILE_HOST_ACL_PACKETS 2
+#else
+#define BLE_MIDI_PROFILE_ACL_BUFFERS 3
+#define BLE_MIDI_PROFILE_HOST_ACL_PACKETS 3
+#endif
+
+#ifndef ROKOT_BLE_MIDI_ACL_BUFFERS
+#define ROKOT_BLE_MIDI_ACL_BUFFERS BLE_MIDI_PROFILE_ACL_BUFFERS
+#endif
+#ifndef ROKOT_BLE_MIDI_HOST_ACL_PACKETS
+#define ROKOT_BLE_MIDI_HOST_ACL_PACKETS BLE_MIDI_PROFILE_HOST_ACL_PACKETS
+#endif
+
 // BTstack features - BLE only
 #define ENABLE_LOG_ERROR
 #define ENABLE_LE_PERIPHERAL
+#if ROKOT_BLE_MIDI_CENTRAL
+#define ENABLE_LE_CENTRAL
+#endif
+#if ROKOT_BLE_MIDI_SECURE_CONNECTIONS
 #define ENABLE_LE_SECURE_CONNECTIONS
+#endif
+#define ENABLE_LE_DATA_LENGTH_EXTENSION
 
 // Required for HCI dump (even if not used, the SDK links it)
 #define ENABLE_PRINTF_HEXDUMP
@@ -18,11 +71,14 @@
 #define HCI_ACL_PAYLOAD_SIZE (255 + 4)
 #define HCI_ACL_CHUNK_SIZE_ALIGNMENT 4
 
-#define MAX_NR_GATT_CLIENTS 1
-#define MAX_NR_HCI_CONNECTIONS 1
-#define MAX_NR_L2CAP_CHANNELS 3
+// One HCI connection and GATT client per central (ROKOT_BLE_MIDI_MAX_CONNECTIONS)
+// plus the link to a peripheral in central mode
+#define BLE_MIDI_NR_LINKS (ROKOT_BLE_MIDI_MAX_CONNECTIONS + ROKOT_BLE_MIDI_CENTRAL)
+#define MAX_NR_GATT_CLIENTS BLE_MIDI_NR_LINKS
+#define MAX_NR_HCI_CONNECTIONS BLE_MIDI_NR_LINKS
+#define MAX_NR_L2CAP_CHANNELS (2 + BLE_MIDI_NR_LINKS)
 #define MAX_NR_L2CAP_SERVICES 2
-#define MAX_NR_SM_LOOKUP_ENTRIES 3
+#define MAX_NR_SM_LOOKUP_ENTRIES (2 + BLE_MIDI_NR_LINKS)
 #define MAX_NR_WHITELIST_ENTRIES 4
 #define MAX_NR_LE_DEVICE_DB_ENTRIES 4
 
@@ -30,14 +86,14 @@
 #define NVM_NUM_DEVICE_DB_ENTRIES 4
 #define NVM_NUM_LINK_KEYS 4
 
-// Limit ACL buffers to avoid CYW43 shared bus overrun
-#define MAX_NR_CONTROLLER_ACL_BUFFERS 3
+// Limit ACL buffers to avoid CYW43 shared bus overrun (see the profiles above)
+#define MAX_NR_CONTROLLER_ACL_BUFFERS ROKOT_BLE_MIDI_ACL_BUFFERS
 #define MAX_NR_CONTROLLER_SCO_PACKETS 3
 
 // HCI Controller to Host Flow Control
 #define ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
 #define HCI_HOST_ACL_PACKET_LEN 256
-#define HCI_HOST_ACL_PACKET_NUM 3
+#define HCI_HOST_ACL_PACKET_NUM ROKOT_BLE_MIDI_HOST_ACL_PACKETS
 #define HCI_HOST_SCO_PACKET_LEN 120
 #define HCI_HOST_SCO_PACKET_NUM 3
 
@@ -53,8 +109,11 @@
 // HCI reset timeout
 #define HCI_RESET_RESEND_TIMEOUT_MS 1000
 
-// Cryptography
+// Cryptography. Without Secure Connections, pairing falls back to legacy
+// Just Works and AES runs on the controller (HCI LE Encrypt).
+#if ROKOT_BLE_MIDI_SECURE_CONNECTIONS
 #define ENABLE_SOFTWARE_AES128
 #define ENABLE_MICRO_ECC_FOR_LE_SECURE_CONNECTIONS
+#endif
 
 #endif // ROKOT_BLE_MIDI_BTSTACK_CONFIG_H
@@ -10,41 +10,563 @@
 
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
+#if ROKOT_BLE_MIDI_MULTICORE
+#include "pico/multicore.h"
+#endif
+#if ROKOT_BLE_MIDI_USB
+#include "tusb.h"
+#endif
+#if ROKOT_BLE_MIDI_RAW_RX_BUFFER || ROKOT_BLE_MIDI_RX_DEFERRED
+#include "hardware/sync.h"
+#endif
 
 #include "btstack.h"
 #include "ble/att_db.h"
 #include "ble/att_server.h"
 
+#include "rokot_ble_midi_codec.h"
 #include "rokot_ble_midi_service.h"
 
+#if ROKOT_BLE_MIDI_MULTICORE && ROKOT_BLE_MIDI_BACKGROUND
+#error "ROKOT_BLE_MIDI_MULTICORE and ROKOT_BLE_MIDI_BACKGROUND are mutually exclusive"
+#endif
+
+// Receive callbacks run from rokot_ble_midi_task()/poll(), fed by a ring
+#define RX_DEFERRED (ROKOT_BLE_MIDI_MULTICORE || ROKOT_BLE_MIDI_RX_DEFERRED)
+
+#if ROKOT_BLE_MIDI_USB && ROKOT_BLE_MIDI_BACKGROUND
+#error "ROKOT_BLE_MIDI_USB requires BTstack and TinyUSB to run in the same context"
+#endif
+
+#if ROKOT_BLE_MIDI_ASYNC_INIT && !ROKOT_BLE_MIDI_MULTICORE
+#error "ROKOT_BLE_MIDI_ASYNC_INIT needs ROKOT_BLE_MIDI_MULTICORE; on one core the CYW43 firmware load still blocks the caller"
+#endif
+
+// Functions on the path from a send call to the queue; see
+// ROKOT_BLE_MIDI_SEND_IN_RAM
+#if ROKOT_BLE_MIDI_SEND_IN_RAM
+#define SEND_PATH_FUNC(name) __not_in_flash_func(name)
+#else
+#define SEND_PATH_FUNC(name) name
+#endif
+
 // ---------------------------------------------------------------------------
 // Internal State
 // ---------------------------------------------------------------------------
 
-static struct {
+// One per connected central. The transmit queue is shared: tx_pos is how many
+// of its entries this peer has already been sent.
+typedef struct {
+  bool in_use;
   hci_con_handle_t con_handle;
   bool notifications_enabled;
-  bool battery_notifications_enabled;
+  uint8_t low_subscribed;      // LOW_PRIORITY_* classes with notifications on
+  uint8_t low_pending;         // LOW_PRIORITY_* classes waiting to be sent
+  bool rx_in_sysex;
   uint16_t connection_interval;
+  uint16_t conn_latency;
+  bool idle;                   // connection policy wants the idle parameters
+  bool params_idle;            // parameters last requested were the idle ones
+  bool params_pending;         // waiting for the central to answer a request
+  uint8_t params_retries;      // requests repeated for the current target
+  uint32_t params_requested_ms;
+  uint32_t last_rx_ms;
+  bool bonded;
+  bd_addr_t peer_addr;
+  uint8_t peer_addr_type;
+  bool phy_request_pending;
+  uint8_t tx_phy;
+  uint8_t rx_phy;
+  bool event_anchor_valid;
+  uint32_t event_anchor_us;    // time_us_32() of a recent connection event
+  uint32_t event_observed_us;  // last time the anchor was confirmed
+  bool send_requested;         // waiting for ATT_EVENT_CAN_SEND_NOW
+#if ROKOT_BLE_MIDI_LATE_FLUSH_US
+  btstack_timer_source_t flush_timer;
+  bool flush_timer_active;
+#endif
+  uint16_t mtu;
+  uint16_t data_length;
+  uint16_t tx_pos;
+  size_t tx_sysex_offset;
+} ble_midi_connection_t;
+
+static struct {
+  ble_midi_connection_t connections[ROKOT_BLE_MIDI_MAX_CONNECTIONS];
   rokot_ble_midi_callback_t rx_callback;
+  rokot_ble_midi_timestamped_callback_t rx_timestamped_callback;
   btstack_packet_callback_registration_t hci_event_callback_registration;
-  char device_name[32];
-  char manufacturer[32];
-  char firmware_version[16];
+  btstack_packet_callback_registration_t sm_event_callback_registration;
+#if ROKOT_BLE_MIDI_DIS
+  char manufacturer[ROKOT_BLE_MIDI_MANUFACTURER_SIZE];
+  char firmware_version[ROKOT_BLE_MIDI_FIRMWARE_VERSION_SIZE];
+#endif
   uint8_t battery_level;
+  uint8_t collapse_types;
   bool initialized;
 } ble_midi_state = {
-  .con_handle = HCI_CON_HANDLE_INVALID,
-  .notifications_enabled = false,
-  .battery_notifications_enabled = false,
-  .connection_interval = 0,
   .rx_callback = NULL,
+  .rx_timestamped_callback = NULL,
+#if ROKOT_BLE_MIDI_DIS
   .manufacturer = ROKOT_BLE_MIDI_MANUFACTURER,
   .firmware_version = ROKOT_BLE_MIDI_FIRMWARE_VERSION,
+#endif
   .battery_level = 100,
   .initialized = false,
 };
 
+static ble_midi_connection_t *connection_for_handle(hci_con_handle_t con_handle) {
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++) {
+    ble_midi_connection_t *conn = &ble_midi_state.connections[i];
+    if (conn->in_use && conn->con_handle == con_handle) return conn;
+  }
+  return NULL;
+}
+
+static ble_midi_connection_t *connection_alloc(hci_con_handle_t con_handle) {
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++) {
+    ble_midi_connection_t *conn = &ble_midi_state.connections[i];
+    if (conn->in_use) continue;
+    memset(conn, 0, sizeof(*conn));
+    conn->in_use = true;
+    conn->con_handle = con_handle;
+    conn->mtu = ATT_DEFAULT_MTU;
+    conn->data_length = 27;
+    conn->tx_phy = conn->rx_phy = 1;
+    return conn;
+  }
+  return NULL;
+}
+
+// First connection in use, reported by the single-connection status getters
+static const ble_midi_connection_t *connection_first(void) {
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++)
+    if (ble_midi_state.connections[i].in_use) return &ble_midi_state.connections[i];
+  return NULL;
+}
+
+static bool SEND_PATH_FUNC(ble_midi_any_ready)(void) {
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++)
+    if (ble_midi_state.connections[i].in_use && ble_midi_state.connections[i].notifications_enabled) return true;
+  return false;
+}
+
+// One can-send-now request per peer is outstanding at a time, so messages
+// queued while it is pending skip the call into BTstack
+static void SEND_PATH_FUNC(conn_request_can_send_now)(ble_midi_connection_t *conn) {
+  if (conn->send_requested) return;
+  conn->send_requested = true;
+  att_server_request_can_send_now_event(conn->con_handle);
+}
+
+// ---------------------------------------------------------------------------
+// Statistics
+// ---------------------------------------------------------------------------
+
+#if ROKOT_BLE_MIDI_ENABLE_STATS
+static struct {
+  rokot_ble_midi_stats_t counters;
+  uint64_t tx_latency_total_us;
+  uint32_t tx_latency_samples;
+  bool connected_before;
+  bool reconnect_pending;
+  uint32_t disconnected_ms;
+#if ROKOT_BLE_MIDI_MULTICORE
+  uint32_t tx_dropped_core0;   // send calls rejected on core 0, owned by core 0
+  rokot_ble_midi_stats_t snapshot;
+#endif
+} ble_midi_stats;
+
+#define STATS_INC(field) (ble_midi_stats.counters.field++)
+#define STATS_ADD(field, n) (ble_midi_stats.counters.field += (n))
+
+// In dual-core mode the counters belong to core 1, which takes snapshots
+// and resets on core 0's behalf; drops seen by the send functions on core 0
+// are kept apart and added in core 0's copy
+#if ROKOT_BLE_MIDI_MULTICORE
+#define STATS_SEND_DROPPED(n) (ble_midi_stats.tx_dropped_core0 += (n))
+#else
+#define STATS_SEND_DROPPED(n) STATS_ADD(tx_dropped, n)
+#endif
+
+// BTstack context, or under ble_midi_lock()
+static void stats_snapshot(rokot_ble_midi_stats_t *stats) {
+  *stats = ble_midi_stats.counters;
+  stats->tx_latency_avg_us = ble_midi_stats.tx_latency_samples
+      ? (uint32_t)(ble_midi_stats.tx_latency_total_us / ble_midi_stats.tx_latency_samples) : 0;
+}
+
+static void stats_reset(void) {
+  memset(&ble_midi_stats.counters, 0, sizeof(ble_midi_stats.counters));
+  ble_midi_stats.reconnect_pending = false;
+  ble_midi_stats.tx_latency_total_us = 0;
+  ble_midi_stats.tx_latency_samples = 0;
+}
+#else
+#define STATS_INC(field) ((void)0)
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_SEND_DROPPED(n) ((void)0)
+#endif
+
+// ---------------------------------------------------------------------------
+// Locking
+// ---------------------------------------------------------------------------
+
+// With pico_cyw43_arch_threadsafe_background BTstack runs from a low-priority
+// IRQ, so API calls that touch shared state take the async context lock. The
+// lock is recursive, so sending from inside a receive callback is fine.
+static inline void ble_midi_lock(void) {
+#if ROKOT_BLE_MIDI_BACKGROUND
+  async_context_acquire_lock_blocking(cyw43_arch_async_context());
+#endif
+}
+
+static inline void ble_midi_unlock(void) {
+#if ROKOT_BLE_MIDI_BACKGROUND
+  async_context_release_lock(cyw43_arch_async_context());
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Connection Parameters
+// ---------------------------------------------------------------------------
+
+// Peers start on the low-latency parameters. After policy.idle_timeout_ms
+// without MIDI in either direction a connection asks for the idle ones, and
+// the first message queued or received asks for the fast ones again. Going
+// idle only on a timeout but waking on any traffic is the hysteresis; one
+// request at a time is in flight per connection, the next waits for the
+// central's answer.
+static struct {
+  rokot_ble_midi_conn_policy_t policy;
+  btstack_timer_source_t timer;
+  bool timer_active;
+  uint32_t last_tx_ms;
+#if ROKOT_BLE_MIDI_MULTICORE
+  rokot_ble_midi_conn_policy_t requested;  // written by core 0
+  volatile bool dirty;
+#endif
+} conn_policy = {
+  .policy = {
+    .idle_timeout_ms = ROKOT_BLE_MIDI_IDLE_TIMEOUT_MS,
+    .idle_interval_min = ROKOT_BLE_MIDI_IDLE_INTERVAL_MIN,
+    .idle_interval_max = ROKOT_BLE_MIDI_IDLE_INTERVAL_MAX,
+    .idle_latency = ROKOT_BLE_MIDI_IDLE_LATENCY,
+  },
+};
+
+// The defaults skip the clamp in rokot_ble_midi_set_conn_policy(); the
+// timeout is in 10 ms units and intervals in 1.25 ms units
+_Static_assert((1 + ROKOT_BLE_MIDI_IDLE_LATENCY) * ROKOT_BLE_MIDI_IDLE_INTERVAL_MAX <
+                   ROKOT_BLE_MIDI_SUPERVISION_TIMEOUT * 4,
+               "ROKOT_BLE_MIDI_SUPERVISION_TIMEOUT too short for the idle interval and latency");
+_Static_assert(ROKOT_BLE_MIDI_IDLE_LATENCY <= 499, "ROKOT_BLE_MIDI_IDLE_LATENCY above 499");
+
+// An answer the central never sends would otherwise stall the policy
+#define CONN_PARAMS_RESPONSE_TIMEOUT_MS 30000
+
+// A central that rejects a request, or grants an interval outside the one
+// asked for, is asked again up to this many times per target
+#define CONN_PARAMS_MAX_RETRIES 3
+
+static void conn_params_apply(ble_midi_connection_t *conn) {
+  if (conn->params_pending || conn->idle == conn->params_idle) return;
+
+  if (conn->idle) {
+    gap_request_connection_parameter_update(conn->con_handle, conn_policy.policy.idle_interval_min,
+        conn_policy.policy.idle_interval_max, conn_policy.policy.idle_latency, ROKOT_BLE_MIDI_SUPERVISION_TIMEOUT);
+  } else {
+    gap_request_connection_parameter_update(conn->con_handle, ROKOT_BLE_MIDI_CONN_INTERVAL_MIN,
+        ROKOT_BLE_MIDI_CONN_INTERVAL_MAX, 0, ROKOT_BLE_MIDI_SUPERVISION_TIMEOUT);
+  }
+  conn->params_idle = conn->idle;
+  conn->params_pending = true;
+  conn->params_requested_ms = btstack_run_loop_get_time_ms();
+}
+
+// Marking the parameters as not requested makes the next conn_params_apply()
+// ask again, from the next activity or policy timer tick at the latest
+static void conn_params_retry(ble_midi_connection_t *conn) {
+  if (conn->params_retries >= CONN_PARAMS_MAX_RETRIES) return;
+  conn->params_retries++;
+  conn->params_idle = !conn->idle;
+}
+
+// Whether the interval in use is inside the one requested for the target
+static bool conn_params_granted(const ble_midi_connection_t *conn) {
+  if (conn->idle)
+    return conn->connection_interval >= conn_policy.policy.idle_interval_min &&
+           conn->connection_interval <= conn_policy.policy.idle_interval_max;
+  return conn->connection_interval >= ROKOT_BLE_MIDI_CONN_INTERVAL_MIN &&
+         conn->connection_interval <= ROKOT_BLE_MIDI_CONN_INTERVAL_MAX;
+}
+
+// Also retries fast parameters the central rejected while already awake
+static void SEND_PATH_FUNC(conn_params_wake)(ble_midi_connection_t *conn) {
+  if (conn->idle) {
+    conn->idle = false;
+    conn->params_retries = 0;
+  }
+  if (conn->params_idle != conn->idle) conn_params_apply(conn);
+}
+
+static void conn_policy_timer_handler(btstack_timer_source_t *timer) {
+  conn_policy.timer_active = false;
+  uint32_t timeout_ms = conn_policy.policy.idle_timeout_ms;
+  if (timeout_ms == 0) return;
+
+  uint32_t now_ms = btstack_run_loop_get_time_ms();
+  bool any = false;
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++) {
+    ble_midi_connection_t *conn = &ble_midi_state.connections[i];
+    if (!conn->in_use) continue;
+    any = true;
+
+    if (conn->params_pending && now_ms - conn->params_requested_ms >= CONN_PARAMS_RESPONSE_TIMEOUT_MS)
+      conn->params_pending = false;
+
+    if (!conn->idle && now_ms - conn_policy.last_tx_ms >= timeout_ms && now_ms - conn->last_rx_ms >= timeout_ms) {
+      conn->idle = true;
+      conn->params_retries = 0;
+    }
+    conn_params_apply(conn);
+  }
+  if (!any) return;
+
+  // A quarter of the timeout is close enough; going idle late costs nothing
+  uint32_t period_ms = timeout_ms / 4;
+  btstack_run_loop_set_timer(timer, period_ms < 10 ? 10 : period_ms);
+  btstack_run_loop_add_timer(timer);
+  conn_policy.timer_active = true;
+}
+
+static void conn_policy_start(void) {
+  if (conn_policy.timer_active || conn_policy.policy.idle_timeout_ms == 0) return;
+  btstack_run_loop_set_timer_handler(&conn_policy.timer, conn_policy_timer_handler);
+  btstack_run_loop_set_timer(&conn_policy.timer, conn_policy.policy.idle_timeout_ms);
+  btstack_run_loop_add_timer(&conn_policy.timer);
+  conn_policy.timer_active = true;
+}
+
+static void SEND_PATH_FUNC(conn_policy_activity)(void) {
+  // Without a policy nothing goes idle, so there is nothing to record
+  if (conn_policy.policy.idle_timeout_ms == 0) return;
+  conn_policy.last_tx_ms = btstack_run_loop_get_time_ms();
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++)
+    if (ble_midi_state.connections[i].in_use) conn_params_wake(&ble_midi_state.connections[i]);
+}
+
+// Applies a policy set through the API; a disabled policy wakes every peer
+static void conn_policy_update(void) {
+#if ROKOT_BLE_MIDI_MULTICORE
+  conn_policy.dirty = false;
+  __dmb();
+  conn_policy.policy = conn_policy.requested;
+#endif
+  if (conn_policy.timer_active) {
+    btstack_run_loop_remove_timer(&conn_policy.timer);
+    conn_policy.timer_active = false;
+  }
+  if (conn_policy.policy.idle_timeout_ms == 0) {
+    for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++)
+      if (ble_midi_state.connections[i].in_use) conn_params_wake(&ble_midi_state.connections[i]);
+    return;
+  }
+  if (connection_first()) conn_policy_start();
+}
+
+// ---------------------------------------------------------------------------
+// Low-Priority Notifications
+// ---------------------------------------------------------------------------
+
+// Battery level and telemetry only go out for a peer with no MIDI waiting
+// for it, and only while another ACL buffer stays free for MIDI; blocked on
+// buffers they resume on Number Of Completed Packets. Each class is a
+// pending flag and the value is read when it is sent, so only the latest
+// value ever goes out.
+#define LOW_PRIORITY_BATTERY 0x01
+#define LOW_PRIORITY_TELEMETRY 0x02
+
+#define LOW_PRIORITY_MIN_FREE_SLOTS ((MAX_NR_CONTROLLER_ACL_BUFFERS > 1) ? 2 : 1)
+
+#if ROKOT_BLE_MIDI_TELEMETRY
+// Telemetry value. In dual-core mode core 0 writes staged under a sequence
+// count, odd while it is being written, and core 1 copies it into data.
+static struct {
+  uint8_t data[ROKOT_BLE_MIDI_TELEMETRY_SIZE];
+  uint16_t len;
+#if ROKOT_BLE_MIDI_MULTICORE
+  uint8_t staged[ROKOT_BLE_MIDI_TELEMETRY_SIZE];
+  uint16_t staged_len;
+  volatile uint32_t seq;
+  uint32_t taken_seq;
+#endif
+} telemetry;
+#endif
+
+// Marks cls pending for every peer subscribed to it
+static void low_priority_mark(uint8_t cls) {
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++) {
+    ble_midi_connection_t *conn = &ble_midi_state.connections[i];
+    if (conn->in_use && (conn->low_subscribed & cls)) {
+      conn->low_pending |= cls;
+      conn_request_can_send_now(conn);
+    }
+  }
+}
+
+static int low_priority_notify(ble_midi_connection_t *conn, uint8_t cls) {
+#if ROKOT_BLE_MIDI_BATTERY
+  if (cls == LOW_PRIORITY_BATTERY)
+    return att_server_notify(conn->con_handle,
+        ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_BATTERY_LEVEL_01_VALUE_HANDLE,
+        &ble_midi_state.battery_level, 1);
+#endif
+#if ROKOT_BLE_MIDI_TELEMETRY
+  if (cls == LOW_PRIORITY_TELEMETRY)
+    return att_server_notify(conn->con_handle,
+        ATT_CHARACTERISTIC_8E6F0002_5A0B_4C3D_9E2F_1B7A6C4D3E20_01_VALUE_HANDLE, telemetry.data, telemetry.len);
+#endif
+  UNUSED(conn);
+  UNUSED(cls);
+  return 0;
+}
+
+// Called from tx_flush() once the peer has no MIDI left to send
+static void low_priority_flush(ble_midi_connection_t *conn) {
+  while (conn->low_pending) {
+    if (!att_server_can_send_packet_now(conn->con_handle)) {
+      conn_request_can_send_now(conn);
+      return;
+    }
+    if (hci_number_free_acl_slots_for_handle(conn->con_handle) < LOW_PRIORITY_MIN_FREE_SLOTS) return;
+    uint8_t cls = (uint8_t)(conn->low_pending & -conn->low_pending);
+    if (low_priority_notify(conn, cls) != 0) {
+      conn_request_can_send_now(conn);
+      return;
+    }
+    conn->low_pending &= (uint8_t)~cls;
+  }
+}
+
+#if ROKOT_BLE_MIDI_BATTERY || ROKOT_BLE_MIDI_TELEMETRY
+// CCCD write for a low-priority characteristic
+static void low_priority_subscribe(ble_midi_connection_t *conn, uint8_t cls, bool enabled) {
+  if (enabled) {
+    conn->low_subscribed |= cls;
+  } else {
+    conn->low_subscribed &= (uint8_t)~cls;
+    conn->low_pending &= (uint8_t)~cls;
+  }
+}
+#endif
+
+#if ROKOT_BLE_MIDI_TELEMETRY && ROKOT_BLE_MIDI_MULTICORE
+// Core 1: takes the staged value unless core 0 is writing it, in which case
+// core 0 flags it again once done
+static void telemetry_take(void) {
+  uint32_t seq = telemetry.seq;
+  if ((seq & 1) || seq == telemetry.taken_seq) return;
+  __dmb();
+  uint16_t len = telemetry.staged_len;
+  memcpy(telemetry.data, telemetry.staged, len);
+  __dmb();
+  if (telemetry.seq != seq) return;
+  telemetry.len = len;
+  telemetry.taken_seq = seq;
+  low_priority_mark(LOW_PRIORITY_TELEMETRY);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Connection Events
+// ---------------------------------------------------------------------------
+
+// The controller reports nothing at the anchor point itself, so event timing
+// is recovered from what follows one: Number Of Completed Packets for
+// notifications that went out, and writes arriving from the central. Both
+// come a little after the event, never before it, so the anchor follows the
+// earliest phase seen at once and later ones only slowly, which also tracks
+// clock drift. The estimate still trails the real anchor by the host's
+// event delay (a few hundred us), which the late-flush guard has to cover.
+// The grid is rebuilt after an interval change and forgotten when nothing
+// has confirmed it for EVENT_ANCHOR_MAX_AGE_US.
+#define EVENT_ANCHOR_MAX_AGE_US 1000000u
+
+static void conn_event_observe(ble_midi_connection_t *conn) {
+  uint32_t now = time_us_32();
+  uint32_t interval_us = conn->connection_interval * 1250u;
+  if (interval_us == 0) return;
+
+  if (!conn->event_anchor_valid || now - conn->event_observed_us > EVENT_ANCHOR_MAX_AGE_US) {
+    conn->event_anchor_us = now;
+  } else {
+    // Phase relative to the nearest predicted event, negative if earlier
+    int32_t error = (int32_t)((now - conn->event_anchor_us) % interval_us);
+    if (error > (int32_t)(interval_us / 2)) error -= (int32_t)interval_us;
+    int32_t correction = (error < 0) ? error : error / 32;
+    conn->event_anchor_us = now - (uint32_t)(error - correction);
+  }
+  conn->event_anchor_valid = true;
+  conn->event_observed_us = now;
+}
+
+// Microseconds until the next predicted connection event, or -1 if unknown
+static int32_t SEND_PATH_FUNC(conn_event_time_to_next_us)(const ble_midi_connection_t *conn) {
+  uint32_t now = time_us_32();
+  uint32_t interval_us = conn->connection_interval * 1250u;
+  if (!conn->event_anchor_valid || interval_us == 0 || now - conn->event_observed_us > EVENT_ANCHOR_MAX_AGE_US)
+    return -1;
+  return (int32_t)(interval_us - (now - conn->event_anchor_us) % interval_us);
+}
+
+// With ROKOT_BLE_MIDI_LATE_FLUSH_US the send request for a peer is held until
+// that long before its next event, so messages queued meanwhile share the
+// notification without missing the event. Run-loop timers tick in whole
+// milliseconds and are rounded down, so the flush lands up to 1 ms earlier
+// than asked; with no estimate, or less than 1 ms to wait, it goes at once.
+#if ROKOT_BLE_MIDI_LATE_FLUSH_US
+static void conn_flush_timer_handler(btstack_timer_source_t *timer) {
+  ble_midi_connection_t *conn = (ble_midi_connection_t *)btstack_run_loop_get_timer_context(timer);
+  conn->flush_timer_active = false;
+  if (conn->in_use && conn->notifications_enabled) conn_request_can_send_now(conn);
+}
+
+static void conn_flush_cancel(ble_midi_connection_t *conn) {
+  if (!conn->flush_timer_active) return;
+  btstack_run_loop_remove_timer(&conn->flush_timer);
+  conn->flush_timer_active = false;
+}
+#endif
+
+static void SEND_PATH_FUNC(conn_request_send)(ble_midi_connection_t *conn) {
+  if (conn->send_requested) return;
+#if ROKOT_BLE_MIDI_LATE_FLUSH_US
+  if (conn->flush_timer_active) return;
+  int32_t wait_us = conn_event_time_to_next_us(conn) - ROKOT_BLE_MIDI_LATE_FLUSH_US;
+  if (wait_us >= 1000) {
+    btstack_run_loop_set_timer_handler(&conn->flush_timer, conn_flush_timer_handler);
+    btstack_run_loop_set_timer_context(&conn->flush_timer, conn);
+    btstack_run_loop_set_timer(&conn->flush_timer, (uint32_t)wait_us / 1000);
+    btstack_run_loop_add_timer(&conn->flush_timer);
+    conn->flush_timer_active = true;
+    return;
+  }
+#endif
+  conn_request_can_send_now(conn);
+}
+
+// Number Of Completed Packets: one connection handle and count per entry
+static void conn_event_handle_completed_packets(const uint8_t *packet, uint16_t size) {
+  uint8_t num_handles = packet[2];
+  for (uint16_t i = 0; i < num_handles && 3u + 4u * i + 4u <= size; i++) {
+    ble_midi_connection_t *conn = connection_for_handle(little_endian_read_16(packet, 3 + 4 * i) & 0x0FFF);
+    if (!conn) continue;
+    conn_event_observe(conn);
+    if (conn->low_pending) conn_request_can_send_now(conn);
+  }
+}
+
 // ---------------------------------------------------------------------------
 // Advertising Data
 // ---------------------------------------------------------------------------
@@ -58,42 +580,1259 @@ static uint8_t adv_data[] = {
   0x33, 0x4B, 0xE8, 0xED, 0x5A, 0x0E, 0xB8, 0x03,
 };
 
-static uint8_t scan_resp_data[32];
-static uint8_t scan_resp_data_len = 0;
+static uint8_t scan_resp_data[32];
+static uint8_t scan_resp_data_len = 0;
+
+static void build_scan_response(const char *name) {
+  size_t name_len = strlen(name);
+  if (name_len > 29) name_len = 29;
+  scan_resp_data[0] = (uint8_t)(name_len + 1);
+  scan_resp_data[1] = BLUETOOTH_DATA_TYPE_COMPLETE_LOCAL_NAME;
+  memcpy(&scan_resp_data[2], name, name_len);
+  scan_resp_data_len = (uint8_t)(name_len + 2);
+}
+
+// ---------------------------------------------------------------------------
+// Advertising Schedule
+// ---------------------------------------------------------------------------
+
+// After a bonded central drops out (link supervision timeout) the device
+// first advertises directly at it, which a central that is still scanning
+// answers within a few connection attempts. Then it advertises fast for
+// ROKOT_BLE_MIDI_ADV_FAST_TIMEOUT_MS and backs off to the slow interval.
+// Boot and other disconnects start at the fast phase. BTstack itself
+// decides whether to advertise at all, based on the free connection slots.
+typedef enum {
+  ADV_DIRECTED,
+  ADV_FAST,
+  ADV_SLOW,
+} adv_phase_t;
+
+static struct {
+  btstack_timer_source_t timer;
+  bool timer_active;
+  adv_phase_t phase;
+  bd_addr_t peer_addr;
+  uint8_t peer_addr_type;
+} adv_schedule;
+
+// High duty cycle directed advertising stops after 1.28 s
+#define ADV_DIRECTED_DURATION_MS 1300
+
+static void adv_schedule_timer_handler(btstack_timer_source_t *timer);
+
+// Sets the advertising parameters for phase and enables advertising; returns
+// how long the phase lasts, 0 if it does not end. BTstack keeps them until the
+// controller is up, so this also works before HCI is powered on.
+static uint32_t adv_schedule_apply(adv_phase_t phase) {
+  adv_schedule.phase = phase;
+
+  bd_addr_t null_addr = {0};
+  uint32_t duration_ms = 0;
+  switch (phase) {
+  case ADV_DIRECTED:
+    gap_advertisements_set_params(ROKOT_BLE_MIDI_ADV_FAST_INTERVAL_MIN, ROKOT_BLE_MIDI_ADV_FAST_INTERVAL_MAX,
+        0x01, adv_schedule.peer_addr_type & 1, adv_schedule.peer_addr, 0x07, 0x00);
+    duration_ms = ADV_DIRECTED_DURATION_MS;
+    break;
+  case ADV_FAST:
+    gap_advertisements_set_params(ROKOT_BLE_MIDI_ADV_FAST_INTERVAL_MIN, ROKOT_BLE_MIDI_ADV_FAST_INTERVAL_MAX,
+        0, 0, null_addr, 0x07, 0x00);
+    duration_ms = ROKOT_BLE_MIDI_ADV_FAST_TIMEOUT_MS;
+    break;
+  case ADV_SLOW:
+    gap_advertisements_set_params(ROKOT_BLE_MIDI_ADV_SLOW_INTERVAL_MIN, ROKOT_BLE_MIDI_ADV_SLOW_INTERVAL_MAX,
+        0, 0, null_addr, 0x07, 0x00);
+    break;
+  }
+  gap_advertisements_enable(1);
+  return duration_ms;
+}
+
+static void adv_schedule_arm(uint32_t duration_ms) {
+  if (duration_ms == 0) return;
+  btstack_run_loop_set_timer_handler(&adv_schedule.timer, adv_schedule_timer_handler);
+  btstack_run_loop_set_timer(&adv_schedule.timer, duration_ms);
+  btstack_run_loop_add_timer(&adv_schedule.timer);
+  adv_schedule.timer_active = true;
+}
+
+static void adv_schedule_set(adv_phase_t phase) {
+  if (adv_schedule.timer_active) {
+    btstack_run_loop_remove_timer(&adv_schedule.timer);
+    adv_schedule.timer_active = false;
+  }
+  adv_schedule_arm(adv_schedule_apply(phase));
+}
+
+static void adv_schedule_timer_handler(btstack_timer_source_t *timer) {
+  UNUSED(timer);
+  adv_schedule.timer_active = false;
+  adv_schedule_set(adv_schedule.phase == ADV_DIRECTED ? ADV_FAST : ADV_SLOW);
+}
+
+// Called once conn is no longer in use
+static void adv_schedule_after_disconnect(const ble_midi_connection_t *conn, uint8_t reason) {
+#if ROKOT_BLE_MIDI_ADV_DIRECTED
+  // Directed advertising is a connectable state of its own; controllers
+  // only have to support it while no other link is up
+  if (conn->bonded && reason == ERROR_CODE_CONNECTION_TIMEOUT && !connection_first()) {
+    memcpy(adv_schedule.peer_addr, conn->peer_addr, sizeof(bd_addr_t));
+    adv_schedule.peer_addr_type = conn->peer_addr_type;
+    adv_schedule_set(ADV_DIRECTED);
+    return;
+  }
+#else
+  UNUSED(conn);
+  UNUSED(reason);
+#endif
+  adv_schedule_set(ADV_FAST);
+}
+
+// ---------------------------------------------------------------------------
+// Boot
+// ---------------------------------------------------------------------------
+
+// Most of the time to advertising goes into hci_power_control(HCI_POWER_ON),
+// which loads the CYW43 firmware and blocks until it is running. Advertising
+// is configured before that, so it starts with the first commands after the
+// controller is up. With ROKOT_BLE_MIDI_ASYNC_INIT the power-on runs from a
+// run-loop timer on core 1 instead of inside rokot_ble_midi_init(), so core 0
+// carries on while it blocks.
+static struct {
+  rokot_ble_midi_boot_stats_t stats;
+  rokot_ble_midi_advertising_callback_t advertising_callback;
+#if ROKOT_BLE_MIDI_ASYNC_INIT
+  btstack_timer_source_t power_timer;
+  bool power_timer_active;
+#endif
+} boot;
+
+#if ROKOT_BLE_MIDI_ASYNC_INIT
+static void boot_power_timer_handler(btstack_timer_source_t *timer) {
+  UNUSED(timer);
+  boot.power_timer_active = false;
+  hci_power_control(HCI_POWER_ON);
+}
+#endif
+
+static void boot_power_on(void) {
+#if ROKOT_BLE_MIDI_ASYNC_INIT
+  btstack_run_loop_set_timer_handler(&boot.power_timer, boot_power_timer_handler);
+  btstack_run_loop_set_timer(&boot.power_timer, 0);
+  btstack_run_loop_add_timer(&boot.power_timer);
+  boot.power_timer_active = true;
+#else
+  hci_power_control(HCI_POWER_ON);
+#endif
+}
+
+// Command Complete for the first LE Set Advertising Enable after boot
+static void boot_handle_command_complete(const uint8_t *packet) {
+  if (boot.stats.advertising_us) return;
+  if (hci_event_command_complete_get_command_opcode(packet) != HCI_OPCODE_HCI_LE_SET_ADVERTISE_ENABLE) return;
+  if (hci_event_command_complete_get_return_parameters(packet)[0] != ERROR_CODE_SUCCESS) return;
+  boot.stats.advertising_us = time_us_32();
+  if (boot.advertising_callback) boot.advertising_callback();
+}
+
+// ---------------------------------------------------------------------------
+// Transmit Queue
+// ---------------------------------------------------------------------------
+
+// Largest BLE-MIDI packet that fits one notification at the requested MTU
+#define TX_PACKET_MAX_LEN (ROKOT_BLE_MIDI_ATT_MTU - 3)
+
+#define TX_FLAG_GROUP_NEXT ROKOT_BLE_MIDI_CODEC_GROUP_NEXT
+
+typedef rokot_ble_midi_codec_entry_t tx_entry_t;
+
+static struct {
+  tx_entry_t entries[ROKOT_BLE_MIDI_TX_QUEUE_LEN];
+  uint16_t head;
+  uint16_t tail;
+  uint16_t count;
+  uint16_t high_water;
+} tx_queue;
+
+static uint8_t tx_packet[TX_PACKET_MAX_LEN];
+
+// Describes what tx_packet holds so peers at the same queue position and MTU
+// are sent the same packet without encoding it again
+static struct {
+  bool valid;
+  uint16_t start;
+  size_t sysex_offset;
+  uint16_t max_len;
+  uint16_t len;
+  uint16_t consumed;
+  size_t next_sysex_offset;
+} tx_packet_cache;
+
+// SysEx being streamed from the caller's buffer. It occupies a single
+// zero-length queue entry so it goes out in order with other messages; each
+// peer tracks its own progress through it in tx_sysex_offset.
+static struct {
+  const uint8_t *data;
+  size_t len;
+} tx_sysex;
+
+// Millisecond count behind the send timestamps, carried forward from the last
+// millisecond boundary so the send path does not call the 64-bit library
+// divide (in flash). Only the first send after a pause of a second or more
+// takes the divide. Send path only: core 0, or under ble_midi_lock().
+static struct {
+  uint64_t us;                         // time_us_64() at the start of ms
+  uint32_t ms;
+} tx_time;
+
+// 13-bit millisecond timestamp as carried in BLE-MIDI header/timestamp bytes
+static uint16_t SEND_PATH_FUNC(ble_midi_timestamp_now)(void) {
+  uint64_t now = time_us_64();
+  if (now - tx_time.us < 1000000) {
+    uint32_t elapsed = (uint32_t)(now - tx_time.us);
+    uint32_t ms = (elapsed * 4195u) >> 22; // elapsed / 1000, or one more
+    if (ms * 1000u > elapsed) ms--;
+    tx_time.ms += ms;
+    tx_time.us += ms * 1000u;
+  } else {
+    uint64_t ms = now / 1000;
+    tx_time.ms = (uint32_t)ms;
+    tx_time.us = ms * 1000;
+  }
+  return (uint16_t)(tx_time.ms & 0x1FFF);
+}
+
+static void SEND_PATH_FUNC(tx_entry_fill)(tx_entry_t *entry, const uint8_t *midi, uint8_t len, uint16_t timestamp, uint8_t flags) {
+  entry->timestamp = timestamp;
+  entry->len = len;
+  entry->flags = flags;
+  for (uint8_t i = 0; i < len; i++) entry->data[i] = midi[i];
+#if ROKOT_BLE_MIDI_ENABLE_STATS
+  entry->queued_us = time_us_32();
+#endif
+}
+
+static uint16_t tx_queue_free(void) {
+  return (uint16_t)(ROKOT_BLE_MIDI_TX_QUEUE_LEN - tx_queue.count);
+}
+
+// Reserves the next slot; the caller fills it before the queue is flushed
+static tx_entry_t *SEND_PATH_FUNC(tx_queue_alloc)(void) {
+  if (tx_queue.count == ROKOT_BLE_MIDI_TX_QUEUE_LEN) return NULL;
+  tx_entry_t *entry = &tx_queue.entries[tx_queue.head];
+  tx_queue.head = (uint16_t)((tx_queue.head + 1) % ROKOT_BLE_MIDI_TX_QUEUE_LEN);
+  tx_queue.count++;
+  if (tx_queue.count > tx_queue.high_water) tx_queue.high_water = tx_queue.count;
+  tx_packet_cache.valid = false;
+  return entry;
+}
+
+#if !ROKOT_BLE_MIDI_MULTICORE
+static bool SEND_PATH_FUNC(tx_queue_push)(const uint8_t *midi, uint8_t len, uint16_t timestamp, uint8_t flags) {
+  tx_entry_t *entry = tx_queue_alloc();
+  if (!entry) return false;
+  tx_entry_fill(entry, midi, len, timestamp, flags);
+  return true;
+}
+#endif
+
+// Collapse key of a message, or 0 if its type is not enabled for collapsing.
+// Note On/Off, mode messages and the RPN/NRPN controllers, whose order
+// matters, are never collapsed.
+static uint16_t SEND_PATH_FUNC(tx_collapse_key)(const uint8_t *midi, uint8_t len) {
+  uint8_t types = ble_midi_state.collapse_types;
+  uint8_t status = midi[0];
+  switch (status & 0xF0) {
+  case 0xA0:
+    if (!(types & ROKOT_BLE_MIDI_COLLAPSE_POLY_PRESSURE) || len != 3) return 0;
+    return (uint16_t)(status << 8 | midi[1]);
+  case 0xB0:
+    if (!(types & ROKOT_BLE_MIDI_COLLAPSE_CONTROL_CHANGE) || len != 3) return 0;
+    if (midi[1] == 6 || midi[1] == 38 || (midi[1] >= 96 && midi[1] <= 101) || midi[1] >= 120) return 0;
+    return (uint16_t)(status << 8 | midi[1]);
+  case 0xD0:
+    if (!(types & ROKOT_BLE_MIDI_COLLAPSE_CHANNEL_PRESSURE) || len != 2) return 0;
+    return (uint16_t)(status << 8);
+  case 0xE0:
+    if (!(types & ROKOT_BLE_MIDI_COLLAPSE_PITCH_BEND) || len != 3) return 0;
+    return (uint16_t)(status << 8);
+  default:
+    return 0;
+  }
+}
+
+// Entries before this position have already gone out to at least one peer
+static uint16_t SEND_PATH_FUNC(tx_queue_unsent_start)(void) {
+  uint16_t start = 0;
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++) {
+    const ble_midi_connection_t *conn = &ble_midi_state.connections[i];
+    if (conn->in_use && conn->notifications_enabled && conn->tx_pos > start) start = conn->tx_pos;
+  }
+  return start;
+}
+
+// Overwrites a pending message with the same key in place, keeping its slot
+// and timestamp. The search walks back from the newest entry across other
+// collapsible messages only, so the new value never overtakes a note, a
+// batch or a SysEx queued after the one it replaces, and stops at entries
+// any peer has already been sent.
+static bool SEND_PATH_FUNC(tx_queue_collapse)(const uint8_t *midi, uint8_t len) {
+  uint16_t key = tx_collapse_key(midi, len);
+  if (!key) return false;
+
+  uint16_t start = tx_queue_unsent_start();
+  uint16_t i = tx_queue.count;
+  while (i > start) {
+    tx_entry_t *entry = &tx_queue.entries[(tx_queue.tail + i - 1) % ROKOT_BLE_MIDI_TX_QUEUE_LEN];
+    if (entry->flags & TX_FLAG_GROUP_NEXT) return false;
+    if (i > 1 && (tx_queue.entries[(tx_queue.tail + i - 2) % ROKOT_BLE_MIDI_TX_QUEUE_LEN].flags & TX_FLAG_GROUP_NEXT))
+      return false;
+
+    uint16_t entry_key = entry->len ? tx_collapse_key(entry->data, entry->len) : 0;
+    if (!entry_key) return false;
+    if (entry_key == key) {
+      memcpy(entry->data, midi, len);
+      tx_packet_cache.valid = false;
+      STATS_INC(tx_collapsed);
+      return true;
+    }
+    i--;
+  }
+  return false;
+}
+
+// Drops the entries every subscribed peer has been sent; with no subscribers
+// left that is the whole queue
+static void tx_queue_release(void) {
+  uint16_t done = tx_queue.count;
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++) {
+    const ble_midi_connection_t *conn = &ble_midi_state.connections[i];
+    if (conn->in_use && conn->notifications_enabled && conn->tx_pos < done) done = conn->tx_pos;
+  }
+  if (done == 0) return;
+
+  // Once the marker is gone the caller's SysEx buffer is no longer referenced
+  for (uint16_t i = 0; i < done && tx_sysex.data; i++)
+    if (tx_queue.entries[(tx_queue.tail + i) % ROKOT_BLE_MIDI_TX_QUEUE_LEN].len == 0) tx_sysex.data = NULL;
+
+  tx_queue.tail = (uint16_t)((tx_queue.tail + done) % ROKOT_BLE_MIDI_TX_QUEUE_LEN);
+  tx_queue.count = (uint16_t)(tx_queue.count - done);
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++) {
+    ble_midi_connection_t *conn = &ble_midi_state.connections[i];
+    conn->tx_pos = (conn->tx_pos > done) ? (uint16_t)(conn->tx_pos - done) : 0;
+  }
+  if (tx_packet_cache.start >= done) tx_packet_cache.start = (uint16_t)(tx_packet_cache.start - done);
+  else tx_packet_cache.valid = false;
+}
+
+static void tx_queue_clear(void) {
+  tx_queue.head = 0;
+  tx_queue.tail = 0;
+  tx_queue.count = 0;
+  tx_sysex.data = NULL;
+  tx_packet_cache.valid = false;
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++) {
+    ble_midi_state.connections[i].tx_pos = 0;
+    ble_midi_state.connections[i].tx_sysex_offset = 0;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// BLE-MIDI Packet Encoding
+// ---------------------------------------------------------------------------
+
+static void tx_entry_fill_msg(tx_entry_t *entry, const rokot_midi_msg_t *msg, uint16_t timestamp, uint8_t flags) {
+  uint8_t midi[3] = {msg->status, msg->data1 & 0x7F, msg->data2 & 0x7F};
+  tx_entry_fill(entry, midi, (uint8_t)(rokot_ble_midi_codec_data_len(msg->status) + 1), timestamp, flags);
+}
+
+// Encodes from the shared queue; see rokot_ble_midi_codec_encode()
+static uint16_t encode_ble_midi_packet(uint8_t *dst, uint16_t max_len, uint16_t start, size_t sysex_offset,
+                                       uint16_t *consumed, size_t *next_sysex_offset) {
+  const rokot_ble_midi_codec_queue_t queue = {
+      .entries = tx_queue.entries,
+      .capacity = ROKOT_BLE_MIDI_TX_QUEUE_LEN,
+      .tail = tx_queue.tail,
+      .count = tx_queue.count,
+      .sysex_data = tx_sysex.data,
+      .sysex_len = tx_sysex.len,
+  };
+  return rokot_ble_midi_codec_encode(&queue, dst, max_len, start, sysex_offset, consumed, next_sysex_offset);
+}
+
+// Fills tx_packet for a peer at queue position start, reusing the packet
+// already there when it was encoded from the same point for the same size
+static void tx_packet_prepare(uint16_t start, size_t sysex_offset, uint16_t max_len) {
+  if (tx_packet_cache.valid && tx_packet_cache.start == start &&
+      tx_packet_cache.sysex_offset == sysex_offset && tx_packet_cache.max_len == max_len)
+    return;
+
+  tx_packet_cache.len = encode_ble_midi_packet(tx_packet, max_len, start, sysex_offset,
+      &tx_packet_cache.consumed, &tx_packet_cache.next_sysex_offset);
+  tx_packet_cache.start = start;
+  tx_packet_cache.sysex_offset = sysex_offset;
+  tx_packet_cache.max_len = max_len;
+  tx_packet_cache.valid = true;
+}
+
+#if ROKOT_BLE_MIDI_ENABLE_STATS
+// Called for the n entries from queue position start sent in one notification
+static void stats_record_notification(uint16_t start, uint16_t n) {
+  uint32_t now = time_us_32();
+  ble_midi_stats.counters.tx_notifications++;
+  ble_midi_stats.counters.tx_messages += n;
+  if (n > 1) ble_midi_stats.counters.tx_coalesced += (uint32_t)(n - 1);
+
+  for (uint16_t i = start; i < start + n; i++) {
+    uint32_t latency = now - tx_queue.entries[(tx_queue.tail + i) % ROKOT_BLE_MIDI_TX_QUEUE_LEN].queued_us;
+    if (latency > ble_midi_stats.counters.tx_latency_max_us) ble_midi_stats.counters.tx_latency_max_us = latency;
+    ble_midi_stats.tx_latency_total_us += latency;
+    ble_midi_stats.tx_latency_samples++;
+  }
+}
+#endif
+
+static void tx_flush(ble_midi_connection_t *conn) {
+  hci_con_handle_t con_handle = conn->con_handle;
+
+  if (conn->notifications_enabled && conn->tx_pos < tx_queue.count) {
+    uint16_t max_len = (uint16_t)(conn->mtu - 3);
+    if (max_len > sizeof(tx_packet)) max_len = sizeof(tx_packet);
+
+    tx_packet_prepare(conn->tx_pos, conn->tx_sysex_offset, max_len);
+    if (tx_packet_cache.len > 0 &&
+        att_server_notify(con_handle, ATT_CHARACTERISTIC_7772E5DB_3868_4112_A1A9_F2669D106BF3_01_VALUE_HANDLE,
+            tx_packet, tx_packet_cache.len) == 0) {
+      conn->tx_sysex_offset = tx_packet_cache.next_sysex_offset;
+#if ROKOT_BLE_MIDI_ENABLE_STATS
+      stats_record_notification(conn->tx_pos, tx_packet_cache.consumed);
+#endif
+      conn->tx_pos = (uint16_t)(conn->tx_pos + tx_packet_cache.consumed);
+      tx_queue_release();
+    }
+  }
+
+  // MIDI always wins the next send slot
+  if (conn->notifications_enabled && conn->tx_pos < tx_queue.count) {
+    conn_request_can_send_now(conn);
+    return;
+  }
+  low_priority_flush(conn);
+}
+
+// Flushed from ATT_EVENT_CAN_SEND_NOW so that everything queued before a
+// peer's next connection event goes out in a single notification
+static void SEND_PATH_FUNC(tx_request_send)(void) {
+  conn_policy_activity();
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++) {
+    ble_midi_connection_t *conn = &ble_midi_state.connections[i];
+    if (conn->in_use && conn->notifications_enabled) conn_request_send(conn);
+  }
+}
+
+// Single-core send paths; in dual-core mode core_tx_drain() feeds the queue
+#if !ROKOT_BLE_MIDI_MULTICORE
+static int SEND_PATH_FUNC(send_midi_locked)(const uint8_t *midi, uint8_t len, uint16_t timestamp) {
+  if (!ble_midi_any_ready()) return -1;
+
+  if (tx_queue_collapse(midi, len)) return 0;
+
+  if (!tx_queue_push(midi, len, timestamp, 0))
+    return -2;
+
+  tx_request_send();
+  return 0;
+}
+
+static int send_sysex_locked(const uint8_t *data, size_t len, uint16_t timestamp) {
+  if (!ble_midi_any_ready()) return -1;
+  if (tx_sysex.data) return -2;
+  if (tx_queue.count == ROKOT_BLE_MIDI_TX_QUEUE_LEN) return -2;
+
+  tx_sysex.data = data;
+  tx_sysex.len = len;
+  tx_queue_push(NULL, 0, timestamp, 0);
+
+  tx_request_send();
+  return 0;
+}
+
+// All or nothing: either every message is queued or none is
+static int send_batch_locked(const rokot_midi_msg_t *msgs, size_t n, uint16_t timestamp) {
+  if (!ble_midi_any_ready()) return -1;
+  if (tx_queue_free() < n) return -2;
+
+  for (size_t i = 0; i < n; i++)
+    tx_entry_fill_msg(tx_queue_alloc(), &msgs[i], timestamp, (i + 1 < n) ? TX_FLAG_GROUP_NEXT : 0);
+
+  tx_request_send();
+  return 0;
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Dual-Core Mode
+// ---------------------------------------------------------------------------
+
+#if ROKOT_BLE_MIDI_MULTICORE
+
+// BTstack and the CYW43 driver live on core 1. Core 0 only touches these
+// single-producer/single-consumer rings: each index is written by one core
+// and published after a memory barrier, so no lock is needed.
+static struct {
+  tx_entry_t entries[ROKOT_BLE_MIDI_TX_QUEUE_LEN];
+  volatile uint16_t head;  // written by core 0
+  volatile uint16_t tail;  // written by core 1
+  uint16_t high_water;
+  const uint8_t *volatile sysex_data;
+  size_t sysex_len;
+  volatile bool battery_dirty;
+  volatile bool telemetry_dirty;
+  volatile bool central_dirty;
+  volatile bool clock_dirty;
+#if ROKOT_BLE_MIDI_ENABLE_STATS
+  volatile uint8_t stats_request;  // CORE_STATS_*, cleared by core 1 when done
+#endif
+} core_tx;
+
+#define CORE_STATS_NONE 0
+#define CORE_STATS_SNAPSHOT 1
+#define CORE_STATS_RESET 2
+
+static volatile enum {
+  CORE1_STARTING = 0,
+  CORE1_RUNNING,
+  CORE1_FAILED,
+  CORE1_STOP_REQUESTED,
+  CORE1_STOPPED,
+} core1_status;
+
+static uint16_t SEND_PATH_FUNC(core_tx_count)(void) {
+  return (uint16_t)((core_tx.head + ROKOT_BLE_MIDI_TX_QUEUE_LEN - core_tx.tail) % ROKOT_BLE_MIDI_TX_QUEUE_LEN);
+}
+
+static uint16_t SEND_PATH_FUNC(core_tx_free)(void) {
+  return (uint16_t)(ROKOT_BLE_MIDI_TX_QUEUE_LEN - 1 - core_tx_count());
+}
+
+// Core 0: entries are filled in place and published together by one index
+// update, so core 1 never sees part of a batch
+static tx_entry_t *SEND_PATH_FUNC(core_tx_slot)(uint16_t i) {
+  return &core_tx.entries[(core_tx.head + i) % ROKOT_BLE_MIDI_TX_QUEUE_LEN];
+}
+
+static void SEND_PATH_FUNC(core_tx_commit)(uint16_t n) {
+  __dmb();
+  core_tx.head = (uint16_t)((core_tx.head + n) % ROKOT_BLE_MIDI_TX_QUEUE_LEN);
+  __sev();
+
+  uint16_t count = core_tx_count();
+  if (count > core_tx.high_water) core_tx.high_water = count;
+}
+
+static bool SEND_PATH_FUNC(core_tx_push)(const uint8_t *midi, uint8_t len, uint16_t timestamp) {
+  if (core_tx_free() == 0) return false;
+  tx_entry_fill(core_tx_slot(0), midi, len, timestamp, 0);
+  core_tx_commit(1);
+  return true;
+}
+
+static bool core_tx_push_batch(const rokot_midi_msg_t *msgs, size_t n, uint16_t timestamp) {
+  if (core_tx_free() < n) return false;
+  for (size_t i = 0; i < n; i++)
+    tx_entry_fill_msg(core_tx_slot((uint16_t)i), &msgs[i], timestamp, (i + 1 < n) ? TX_FLAG_GROUP_NEXT : 0);
+  core_tx_commit((uint16_t)n);
+  return true;
+}
+
+static void clock_update(void);
+#if ROKOT_BLE_MIDI_CENTRAL
+static void central_update(void);
+#endif
+
+// Core 1: moves entries into the TX queue until it fills up, a batch at a
+// time. Entries arriving while not ready are discarded.
+static void core_tx_drain(void) {
+  bool queued = false;
+
+  while (core_tx.tail != core_tx.head) {
+    __dmb();
+    uint16_t tail = core_tx.tail;
+    uint16_t n = 1;
+    while (core_tx.entries[(tail + n - 1) % ROKOT_BLE_MIDI_TX_QUEUE_LEN].flags & TX_FLAG_GROUP_NEXT) n++;
+    bool is_sysex = core_tx.entries[tail].len == 0;
+
+    if (ble_midi_any_ready()) {
+      const tx_entry_t *first = &core_tx.entries[tail];
+      if (n == 1 && !is_sysex && tx_queue_collapse(first->data, first->len)) {
+        __dmb();
+        core_tx.tail = (uint16_t)((tail + 1) % ROKOT_BLE_MIDI_TX_QUEUE_LEN);
+        continue;
+      }
+      if (tx_queue_free() < n) break;
+      if (is_sysex) {
+        if (tx_sysex.data) break;
+        tx_sysex.data = core_tx.sysex_data;
+        tx_sysex.len = core_tx.sysex_len;
+      }
+      // Copying whole entries keeps core 0's timestamps and flags
+      for (uint16_t i = 0; i < n; i++) *tx_queue_alloc() = core_tx.entries[(tail + i) % ROKOT_BLE_MIDI_TX_QUEUE_LEN];
+      queued = true;
+    }
+
+    __dmb();
+    if (is_sysex) core_tx.sysex_data = NULL;
+    core_tx.tail = (uint16_t)((tail + n) % ROKOT_BLE_MIDI_TX_QUEUE_LEN);
+  }
+
+  if (queued) tx_request_send();
+
+  if (core_tx.battery_dirty) {
+    core_tx.battery_dirty = false;
+    low_priority_mark(LOW_PRIORITY_BATTERY);
+  }
+
+#if ROKOT_BLE_MIDI_TELEMETRY
+  if (core_tx.telemetry_dirty) {
+    core_tx.telemetry_dirty = false;
+    telemetry_take();
+  }
+#endif
+
+  if (core_tx.clock_dirty) {
+    core_tx.clock_dirty = false;
+    clock_update();
+  }
+
+  if (conn_policy.dirty) conn_policy_update();
+
+#if ROKOT_BLE_MIDI_ENABLE_STATS
+  if (core_tx.stats_request != CORE_STATS_NONE) {
+    if (core_tx.stats_request == CORE_STATS_SNAPSHOT)
+      stats_snapshot(&ble_midi_stats.snapshot);
+    else
+      stats_reset();
+    __dmb();
+    core_tx.stats_request = CORE_STATS_NONE;
+  }
+#endif
+
+#if ROKOT_BLE_MIDI_CENTRAL
+  if (core_tx.central_dirty) {
+    core_tx.central_dirty = false;
+    central_update();
+  }
+#endif
+}
+
+#endif // ROKOT_BLE_MIDI_MULTICORE
+
+// ---------------------------------------------------------------------------
+// Receive Queue
+// ---------------------------------------------------------------------------
+
+#if RX_DEFERRED
+
+// Decoded messages on their way from BTstack context to the receive
+// callbacks, which run from rokot_ble_midi_task()/poll() (core 0 in dual-core
+// mode) so a slow callback never holds up the BLE stack. Same
+// single-producer/single-consumer scheme as the dual-core TX ring.
+typedef struct {
+  uint16_t timestamp;
+  uint8_t status;
+  uint8_t data1;
+  uint8_t data2;
+} rx_event_t;
+
+static struct {
+  rx_event_t events[ROKOT_BLE_MIDI_RX_QUEUE_LEN];
+  volatile uint16_t head;  // written by BTstack context
+  volatile uint16_t tail;  // written by the task()/poll() caller
+} rx_queue;
+
+static bool rx_queue_push(const rx_event_t *event) {
+  uint16_t head = rx_queue.head;
+  uint16_t next = (uint16_t)((head + 1) % ROKOT_BLE_MIDI_RX_QUEUE_LEN);
+  if (next == rx_queue.tail) {
+    STATS_INC(rx_dropped);
+    return false;
+  }
+  rx_queue.events[head] = *event;
+  __dmb();
+  rx_queue.head = next;
+#if ROKOT_BLE_MIDI_MULTICORE
+  __sev();
+#endif
+  return true;
+}
+
+static void rx_dispatch(const rx_event_t *event);
+
+// Delivers what was queued when called; messages arriving from inside a
+// callback wait for the next call, so a flood cannot keep the caller here.
+// Each slot is released before its callback runs.
+static void rx_queue_drain(void) {
+  uint16_t head = rx_queue.head;
+  while (rx_queue.tail != head) {
+    __dmb();
+    rx_event_t event = rx_queue.events[rx_queue.tail];
+    __dmb();
+    rx_queue.tail = (uint16_t)((rx_queue.tail + 1) % ROKOT_BLE_MIDI_RX_QUEUE_LEN);
+    rx_dispatch(&event);
+  }
+}
+
+#endif // RX_DEFERRED
+
+static int SEND_PATH_FUNC(send_midi_internal)(const uint8_t *midi, uint8_t len) {
+#if ROKOT_BLE_MIDI_MULTICORE
+  if (!ble_midi_any_ready()) return -1;
+  int result = core_tx_push(midi, len, ble_midi_timestamp_now()) ? 0 : -2;
+  if (result == -2) STATS_SEND_DROPPED(1);
+#else
+  ble_midi_lock();
+  int result = send_midi_locked(midi, len, ble_midi_timestamp_now());
+  if (result == -2) STATS_SEND_DROPPED(1);
+  ble_midi_unlock();
+#endif
+  return result;
+}
+
+static int send_batch_internal(const rokot_midi_msg_t *msgs, size_t n) {
+#if ROKOT_BLE_MIDI_MULTICORE
+  if (!ble_midi_any_ready()) return -1;
+  int result = core_tx_push_batch(msgs, n, ble_midi_timestamp_now()) ? 0 : -2;
+  if (result == -2) STATS_SEND_DROPPED(n);
+#else
+  ble_midi_lock();
+  int result = send_batch_locked(msgs, n, ble_midi_timestamp_now());
+  if (result == -2) STATS_SEND_DROPPED(n);
+  ble_midi_unlock();
+#endif
+  return result;
+}
+
+static int send_sysex_internal(const uint8_t *data, size_t len) {
+#if ROKOT_BLE_MIDI_MULTICORE
+  if (!ble_midi_any_ready()) return -1;
+  int result = -2;
+  if (!core_tx.sysex_data && !tx_sysex.data) {
+    core_tx.sysex_data = data;
+    core_tx.sysex_len = len;
+    if (core_tx_push(NULL, 0, ble_midi_timestamp_now())) return 0;
+    core_tx.sysex_data = NULL;
+  }
+  STATS_SEND_DROPPED(1);
+#else
+  ble_midi_lock();
+  int result = send_sysex_locked(data, len, ble_midi_timestamp_now());
+  if (result == -2) STATS_SEND_DROPPED(1);
+  ble_midi_unlock();
+#endif
+  return result;
+}
+
+// ---------------------------------------------------------------------------
+// MIDI Clock
+// ---------------------------------------------------------------------------
+
+// 24 PPQN clock generated from a BTstack timer, so ticks are queued in
+// BTstack context (core 1 in dual-core mode) without a trip through the
+// send functions. Each tick carries the timestamp of the millisecond it was
+// scheduled for rather than the one the timer happened to fire in.
+static struct {
+  btstack_timer_source_t timer;
+  volatile uint32_t period_q8;         // tick period in 1/256 us
+  volatile uint8_t request;            // transport byte to send, 0 for none
+  volatile bool running;
+  bool timer_active;
+  uint64_t next_tick_q8;               // time_us_64() of the next tick, << 8
+} ble_midi_clock;
+
+// Received clock: smoothed interval between ticks, from the sender's
+// timestamps so that connection-interval jitter does not show up in it
+static struct {
+  uint16_t last_timestamp;
+  volatile uint32_t last_us;
+  volatile uint32_t interval_us;
+  bool have_last;
+} rx_clock;
+
+static uint32_t clock_period_q8(float bpm) {
+  if (bpm < 1.0f) bpm = 1.0f;
+  if (bpm > 999.0f) bpm = 999.0f;
+  return (uint32_t)(60000000.0f * 256.0f / (bpm * 24.0f));
+}
+
+static void clock_queue(uint8_t status, uint16_t timestamp) {
+  if (!ble_midi_any_ready()) return;
+
+  // Never go back in time relative to what is already queued; the encoder
+  // would have to start a new packet for it
+  if (tx_queue.count > 0) {
+    uint16_t last = tx_queue.entries[(tx_queue.head + ROKOT_BLE_MIDI_TX_QUEUE_LEN - 1) % ROKOT_BLE_MIDI_TX_QUEUE_LEN].timestamp;
+    uint16_t behind = (uint16_t)((last - timestamp) & 0x1FFF);
+    if (behind != 0 && behind < 0x1000) timestamp = last;
+  }
+
+  tx_entry_t *entry = tx_queue_alloc();
+  if (!entry) {
+    STATS_INC(tx_dropped);
+    return;
+  }
+  tx_entry_fill(entry, &status, 1, timestamp, 0);
+  tx_request_send();
+}
+
+static void clock_timer_handler(btstack_timer_source_t *timer) {
+  ble_midi_clock.timer_active = false;
+  if (!ble_midi_clock.running) return;
+
+  uint64_t now_q8 = time_us_64() << 8;
+  while (ble_midi_clock.next_tick_q8 <= now_q8) {
+    clock_queue(0xF8, (uint16_t)(((ble_midi_clock.next_tick_q8 >> 8) / 1000) & 0x1FFF));
+    ble_midi_clock.next_tick_q8 += ble_midi_clock.period_q8;
+  }
+
+  // Rounded up: firing late only delays the tick, its timestamp stays exact
+  uint32_t delay_ms = (uint32_t)((((ble_midi_clock.next_tick_q8 - now_q8) >> 8) + 999) / 1000);
+  btstack_run_loop_set_timer(timer, delay_ms);
+  btstack_run_loop_add_timer(timer);
+  ble_midi_clock.timer_active = true;
+}
+
+// Applies a start/continue/stop request made from the API
+static void clock_update(void) {
+  uint8_t request = ble_midi_clock.request;
+  ble_midi_clock.request = 0;
+  if (!request) return;
+
+  if (ble_midi_clock.timer_active) {
+    btstack_run_loop_remove_timer(&ble_midi_clock.timer);
+    ble_midi_clock.timer_active = false;
+  }
+
+  // Start/Continue and the first tick go out in the same millisecond
+  uint64_t now_us = time_us_64();
+  clock_queue(request, (uint16_t)((now_us / 1000) & 0x1FFF));
+  if (!ble_midi_clock.running) return;
+
+  ble_midi_clock.next_tick_q8 = now_us << 8;
+  btstack_run_loop_set_timer_handler(&ble_midi_clock.timer, clock_timer_handler);
+  clock_timer_handler(&ble_midi_clock.timer);
+}
+
+static void clock_request(uint8_t status, bool running) {
+  ble_midi_clock.running = running;
+  ble_midi_clock.request = status;
+#if ROKOT_BLE_MIDI_MULTICORE
+  core_tx.clock_dirty = true;
+  __sev();
+#else
+  ble_midi_lock();
+  clock_update();
+  ble_midi_unlock();
+#endif
+}
+
+static void rx_clock_tick(uint16_t timestamp) {
+  uint32_t now_us = time_us_32();
+  // A gap of more than a second means the clock stopped; start over
+  if (rx_clock.have_last && now_us - rx_clock.last_us < 1000000) {
+    uint32_t sample_us = (uint32_t)((timestamp - rx_clock.last_timestamp) & 0x1FFF) * 1000;
+    uint32_t interval_us = rx_clock.interval_us;
+    if (interval_us == 0) {
+      interval_us = sample_us;
+    } else {
+      // Timestamps have 1 ms resolution, so average over ~16 ticks
+      interval_us = (uint32_t)((int32_t)interval_us + ((int32_t)sample_us - (int32_t)interval_us) / 16);
+    }
+    rx_clock.interval_us = interval_us;
+  } else {
+    rx_clock.interval_us = 0;
+  }
+  rx_clock.last_timestamp = timestamp;
+  rx_clock.last_us = now_us;
+  rx_clock.have_last = true;
+}
+
+// ---------------------------------------------------------------------------
+// USB-MIDI Bridge
+// ---------------------------------------------------------------------------
+
+#if ROKOT_BLE_MIDI_USB
+
+// USB-MIDI event packets are cable/CIN followed by three MIDI bytes; this is
+// how many of those bytes each Code Index Number uses
+static const uint8_t usb_cin_len[16] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+
+static struct {
+  // USB to BLE: SysEx payload collected between F0 and F7. A SysEx arriving
+  // while the previous one is still being sent is dropped.
+  uint8_t tx_sysex[ROKOT_BLE_MIDI_USB_SYSEX_LEN];
+  size_t tx_sysex_len;
+  bool tx_sysex_active;
+  bool tx_sysex_dropping;
+  // BLE to USB: SysEx bytes not yet written in a 3-byte packet
+  uint8_t rx_sysex[3];
+  uint8_t rx_sysex_len;
+  bool rx_sysex_active;
+} usb_bridge;
+
+#if ROKOT_BLE_MIDI_MULTICORE
+// Core 1 hands USB-MIDI packets for the host to core 0, which owns TinyUSB
+static struct {
+  uint8_t packets[ROKOT_BLE_MIDI_RX_QUEUE_LEN][4];
+  volatile uint16_t head;  // written by core 1
+  volatile uint16_t tail;  // written by core 0
+} core_usb;
+#endif
+
+static void usb_bridge_write(uint8_t cin, uint8_t b0, uint8_t b1, uint8_t b2) {
+  uint8_t packet[4] = {cin, b0, b1, b2};
+#if ROKOT_BLE_MIDI_MULTICORE
+  uint16_t head = core_usb.head;
+  uint16_t next = (uint16_t)((head + 1) % ROKOT_BLE_MIDI_RX_QUEUE_LEN);
+  if (next == core_usb.tail) return;
+  memcpy(core_usb.packets[head], packet, 4);
+  __dmb();
+  core_usb.head = next;
+  __sev();
+#else
+  tud_midi_packet_write(packet);
+#endif
+}
+
+// Called by the decoder for every SysEx byte from F0 to F7, so SysEx is
+// streamed to the host as it arrives instead of being reassembled
+static void usb_bridge_rx_sysex(uint8_t b) {
+  if (b == 0xF0) {
+    usb_bridge.rx_sysex_active = true;
+    usb_bridge.rx_sysex_len = 0;
+  } else if (!usb_bridge.rx_sysex_active) {
+    return;
+  }
+
+  usb_bridge.rx_sysex[usb_bridge.rx_sysex_len++] = b;
+  const uint8_t *d = usb_bridge.rx_sysex;
+  if (b == 0xF7) {
+    // CIN 0x5/0x6/0x7: SysEx ends with 1, 2 or 3 bytes
+    uint8_t n = usb_bridge.rx_sysex_len;
+    usb_bridge_write((uint8_t)(0x4 + n), d[0], n > 1 ? d[1] : 0, n > 2 ? d[2] : 0);
+    usb_bridge.rx_sysex_active = false;
+    usb_bridge.rx_sysex_len = 0;
+  } else if (usb_bridge.rx_sysex_len == 3) {
+    usb_bridge_write(0x4, d[0], d[1], d[2]);
+    usb_bridge.rx_sysex_len = 0;
+  }
+}
+
+static void usb_bridge_rx_message(uint8_t status, uint8_t data1, uint8_t data2) {
+  uint8_t cin;
+  if (status < 0xF0) {
+    cin = status >> 4;
+  } else if (status >= 0xF8) {
+    // Real-time packets may interleave a SysEx
+    usb_bridge_write(0xF, status, 0, 0);
+    return;
+  } else {
+    cin = (status == 0xF2) ? 0x3 : (status == 0xF6) ? 0x5 : 0x2;
+  }
+
+  // A message arriving mid-SysEx means that SysEx was aborted; close it
+  if (usb_bridge.rx_sysex_active) usb_bridge_rx_sysex(0xF7);
+  usb_bridge_write(cin, status, data1, data2);
+}
+
+static void usb_bridge_tx_sysex(const uint8_t *bytes, uint8_t n) {
+  for (uint8_t i = 0; i < n; i++) {
+    uint8_t b = bytes[i];
+    if (b == 0xF0) {
+      usb_bridge.tx_sysex_active = true;
+      usb_bridge.tx_sysex_len = 0;
+      usb_bridge.tx_sysex_dropping = rokot_ble_midi_is_sysex_busy();
+    } else if (!usb_bridge.tx_sysex_active) {
+      continue;
+    } else if (b == 0xF7) {
+      usb_bridge.tx_sysex_active = false;
+      if (usb_bridge.tx_sysex_dropping)
+        STATS_SEND_DROPPED(1);
+      else
+        send_sysex_internal(usb_bridge.tx_sysex, usb_bridge.tx_sysex_len);
+    } else if (usb_bridge.tx_sysex_dropping) {
+      continue;
+    } else if ((b & 0x80) || usb_bridge.tx_sysex_len == sizeof(usb_bridge.tx_sysex)) {
+      usb_bridge.tx_sysex_dropping = true;
+    } else {
+      usb_bridge.tx_sysex[usb_bridge.tx_sysex_len++] = b;
+    }
+  }
+}
+
+// Core 0 / main loop: runs TinyUSB and moves host packets straight into the
+// transmit queue, so forwarding adds at most the wait for the next
+// connection event
+static void usb_bridge_task(void) {
+  tud_task();
+
+#if ROKOT_BLE_MIDI_MULTICORE
+  while (core_usb.tail != core_usb.head) {
+    __dmb();
+    if (!tud_midi_packet_write(core_usb.packets[core_usb.tail])) break;
+    __dmb();
+    core_usb.tail = (uint16_t)((core_usb.tail + 1) % ROKOT_BLE_MIDI_RX_QUEUE_LEN);
+  }
+#endif
+
+  uint8_t packet[4];
+  while (tud_midi_available() && tud_midi_packet_read(packet)) {
+    uint8_t cin = packet[0] & 0x0F;
+    uint8_t len = usb_cin_len[cin];
+    if (len == 0) continue;
+
+    // CIN 0x5 is either Tune Request or a SysEx ending in a single F7
+    if (cin >= 0x4 && cin <= 0x7 && !(cin == 0x5 && packet[1] == 0xF6))
+      usb_bridge_tx_sysex(&packet[1], len);
+    else if (packet[1] & 0x80)
+      send_midi_internal(&packet[1], len);
+  }
+}
+
+#endif // ROKOT_BLE_MIDI_USB
+
+// ---------------------------------------------------------------------------
+// Raw Receive
+// ---------------------------------------------------------------------------
+
+// Incoming BLE-MIDI packets as written (or notified, in central mode), before
+// decoding. Delivered in place from BTstack context, or copied into a byte
+// ring and delivered from rokot_ble_midi_task()/poll() in deferred mode.
+static struct {
+  rokot_ble_midi_raw_callback_t callback;
+  bool deferred;
+} rx_raw;
+
+#if ROKOT_BLE_MIDI_RAW_RX_BUFFER
+
+// Records are a header followed by the payload, padded to 4 bytes. One that
+// does not fit before the end of the buffer goes to the start, with a
+// RAW_RX_WRAP header left behind. head and tail never meet unless empty.
+// Single producer (BTstack context) and single consumer, as for rx_queue.
+#define RAW_RX_RING_SIZE ((ROKOT_BLE_MIDI_RAW_RX_BUFFER + 3) & ~3)
+#define RAW_RX_WRAP 0xFFFF
+
+typedef struct {
+  uint16_t len;
+  uint16_t con_handle;
+  uint32_t arrival_us;
+} rx_raw_header_t;
+
+static struct {
+  uint8_t buffer[RAW_RX_RING_SIZE] __attribute__((aligned(4)));
+  volatile uint16_t head;  // written by BTstack context
+  volatile uint16_t tail;  // written by the task()/poll() caller
+} rx_raw_ring;
+
+static uint16_t rx_raw_record_len(uint16_t len) {
+  return (uint16_t)((sizeof(rx_raw_header_t) + len + 3) & ~3u);
+}
+
+static bool rx_raw_push(uint16_t con_handle, const uint8_t *data, uint16_t len, uint32_t arrival_us) {
+  uint16_t need = rx_raw_record_len(len);
+  uint16_t head = rx_raw_ring.head;
+  uint16_t tail = rx_raw_ring.tail;
+  uint16_t at = head;
+
+  if (head >= tail) {
+    // Filling up to the end is only allowed if head can then wrap to 0
+    uint16_t room_end = (uint16_t)(RAW_RX_RING_SIZE - head - (tail == 0 ? 4 : 0));
+    if (need > room_end) {
+      if (need >= tail) return false;
+      ((rx_raw_header_t *)&rx_raw_ring.buffer[head])->len = RAW_RX_WRAP;
+      at = 0;
+    }
+  } else if (need >= tail - head) {
+    return false;
+  }
+
+  rx_raw_header_t *header = (rx_raw_header_t *)&rx_raw_ring.buffer[at];
+  header->len = len;
+  header->con_handle = con_handle;
+  header->arrival_us = arrival_us;
+  memcpy(header + 1, data, len);
+
+  __dmb();
+  rx_raw_ring.head = (uint16_t)((at + need) % RAW_RX_RING_SIZE);
+  return true;
+}
+
+static void rx_raw_drain(void) {
+  while (rx_raw_ring.tail != rx_raw_ring.head) {
+    __dmb();
+    uint16_t tail = rx_raw_ring.tail;
+    const rx_raw_header_t *header = (const rx_raw_header_t *)&rx_raw_ring.buffer[tail];
+    if (header->len == RAW_RX_WRAP) {
+      rx_raw_ring.tail = 0;
+      continue;
+    }
+
+    rokot_ble_midi_raw_callback_t callback = rx_raw.callback;
+    if (callback) callback(header->con_handle, (const uint8_t *)(header + 1), header->len, header->arrival_us);
+    __dmb();
+    rx_raw_ring.tail = (uint16_t)((tail + rx_raw_record_len(header->len)) % RAW_RX_RING_SIZE);
+  }
+}
+#endif
+
+static void rx_raw_deliver(hci_con_handle_t con_handle, const uint8_t *data, uint16_t len) {
+  rokot_ble_midi_raw_callback_t callback = rx_raw.callback;
+  if (!callback) return;
+  uint32_t arrival_us = time_us_32();
+#if ROKOT_BLE_MIDI_RAW_RX_BUFFER
+  if (rx_raw.deferred) {
+    if (!rx_raw_push(con_handle, data, len, arrival_us)) STATS_INC(rx_raw_dropped);
+    return;
+  }
+#endif
+  callback(con_handle, data, len, arrival_us);
+}
+
+// ---------------------------------------------------------------------------
+// BLE-MIDI Packet Decoding
+// ---------------------------------------------------------------------------
+
+// Decoder state. An unterminated SysEx carries over (per peer, in
+// rx_in_sysex) so continuation packets are reassembled.
+static struct {
+  hci_con_handle_t con_handle;
+  rokot_ble_midi_decoder_t decoder;
+} rx_parser;
+
+// In dual-core mode the buffer is owned by core 0 from the time a completed
+// SysEx is queued until its callback returns; SysEx arriving meanwhile is
+// dropped rather than overwriting it. Only one peer's SysEx is reassembled at
+// a time; another peer's arriving meanwhile is dropped.
+static struct {
+  hci_con_handle_t con_handle;
+  uint8_t *buffer;
+  size_t size;
+  size_t len;
+  bool truncated;
+  bool active;
+  volatile bool delivering;
+  rokot_ble_midi_sysex_callback_t callback;
+} rx_sysex;
+
+static void rx_sysex_store(uint8_t b) {
+  if (rx_sysex.len < rx_sysex.size) rx_sysex.buffer[rx_sysex.len++] = b;
+  else rx_sysex.truncated = true;
+}
+
+static void rx_sysex_append(uint8_t b) {
+#if ROKOT_BLE_MIDI_USB
+  usb_bridge_rx_sysex(b);
+#endif
+  if (!rx_sysex.active || rx_sysex.con_handle != rx_parser.con_handle) return;
+  rx_sysex_store(b);
+}
+
+static void rx_sysex_begin(void) {
+#if ROKOT_BLE_MIDI_USB
+  usb_bridge_rx_sysex(0xF0);
+#endif
+  if (rx_sysex.active && rx_sysex.con_handle != rx_parser.con_handle) return;
+  rx_sysex.con_handle = rx_parser.con_handle;
+  rx_sysex.len = 0;
+  rx_sysex.truncated = false;
+  rx_sysex.active = rx_sysex.buffer && !rx_sysex.delivering;
+  if (rx_sysex.active) rx_sysex_store(0xF0);
+}
+
+static void rx_sysex_end(void) {
+#if ROKOT_BLE_MIDI_USB
+  usb_bridge_rx_sysex(0xF7);
+#endif
+  if (!rx_sysex.active || rx_sysex.con_handle != rx_parser.con_handle) return;
+  rx_sysex.active = false;
+  rx_sysex_store(0xF7);
+#if RX_DEFERRED
+  rx_event_t event = {.status = 0xF0};
+  rx_sysex.delivering = true;
+  __dmb();
+  if (!rx_queue_push(&event)) rx_sysex.delivering = false;
+#else
+  if (rx_sysex.callback) rx_sysex.callback(rx_sysex.buffer, rx_sysex.len, rx_sysex.truncated);
+#endif
+}
+
+#if RX_DEFERRED
+static void rx_dispatch(const rx_event_t *event) {
+  if (event->status == 0xF0) {
+    if (rx_sysex.callback) rx_sysex.callback(rx_sysex.buffer, rx_sysex.len, rx_sysex.truncated);
+    __dmb();
+    rx_sysex.delivering = false;
+    return;
+  }
+  if (ble_midi_state.rx_callback) ble_midi_state.rx_callback(event->status, event->data1, event->data2);
+  if (ble_midi_state.rx_timestamped_callback)
+    ble_midi_state.rx_timestamped_callback(event->timestamp, event->status, event->data1, event->data2);
+}
+#endif
 
-static void build_scan_response(const char *name) {
-  size_t name_len = strlen(name);
-  if (name_len > 29) name_len = 29;
-  scan_resp_data[0] = (uint8_t)(name_len + 1);
-  scan_resp_data[1] = BLUETOOTH_DATA_TYPE_COMPLETE_LOCAL_NAME;
-  memcpy(&scan_resp_data[2], name, name_len);
-  scan_resp_data_len = (uint8_t)(name_len + 2);
+static void rx_emit(uint16_t timestamp, uint8_t status, uint8_t data1, uint8_t data2) {
+  STATS_INC(rx_messages);
+  if (status == 0xF8) rx_clock_tick(timestamp);
+  else if (status == 0xFA || status == 0xFC) rx_clock.have_last = false;
+#if ROKOT_BLE_MIDI_USB
+  usb_bridge_rx_message(status, data1, data2);
+#endif
+#if RX_DEFERRED
+  rx_event_t event = {.timestamp = timestamp, .status = status, .data1 = data1, .data2 = data2};
+  rx_queue_push(&event);
+#else
+  if (ble_midi_state.rx_callback) ble_midi_state.rx_callback(status, data1, data2);
+  if (ble_midi_state.rx_timestamped_callback)
+    ble_midi_state.rx_timestamped_callback(timestamp, status, data1, data2);
+#endif
 }
 
-// ---------------------------------------------------------------------------
-// BLE-MIDI Packet Encoding
-// ---------------------------------------------------------------------------
+static void rx_on_message(void *context, uint16_t timestamp, uint8_t status, uint8_t data1, uint8_t data2) {
+  UNUSED(context);
+  rx_emit(timestamp, status, data1, data2);
+}
 
-static uint16_t encode_ble_midi_packet(uint8_t *dst, const uint8_t *midi, uint8_t midi_len) {
-  dst[0] = 0x80;
-  dst[1] = 0x80;
-  memcpy(&dst[2], midi, midi_len);
-  return midi_len + 2;
+static void rx_on_sysex_begin(void *context) {
+  UNUSED(context);
+  rx_sysex_begin();
 }
 
-static int send_midi_internal(const uint8_t *midi, uint8_t len) {
-  if (!ble_midi_state.notifications_enabled || ble_midi_state.con_handle == HCI_CON_HANDLE_INVALID)
-    return -1;
+static void rx_on_sysex_data(void *context, const uint8_t *data, uint16_t len) {
+  UNUSED(context);
+  for (uint16_t i = 0; i < len; i++) rx_sysex_append(data[i]);
+}
 
-  uint8_t packet[32];
-  uint16_t packet_len = encode_ble_midi_packet(packet, midi, len);
+static void rx_on_sysex_end(void *context) {
+  UNUSED(context);
+  rx_sysex_end();
+}
 
-  if (!att_server_can_send_packet_now(ble_midi_state.con_handle))
-    return -2;
+static void rx_on_error(void *context) {
+  UNUSED(context);
+  STATS_INC(rx_parse_errors);
+}
+
+static const rokot_ble_midi_codec_handlers_t rx_handlers = {
+    .message = rx_on_message,
+    .sysex_begin = rx_on_sysex_begin,
+    .sysex_data = rx_on_sysex_data,
+    .sysex_end = rx_on_sysex_end,
+    .error = rx_on_error,
+};
 
-  int result = att_server_notify(ble_midi_state.con_handle,
-      ATT_CHARACTERISTIC_7772E5DB_3868_4112_A1A9_F2669D106BF3_01_VALUE_HANDLE, packet, packet_len);
-  return (result == 0) ? 0 : -3;
+static void decode_ble_midi_packet(const uint8_t *buf, uint16_t len) {
+  rx_parser.decoder.handlers = &rx_handlers;
+  rokot_ble_midi_codec_decode(&rx_parser.decoder, buf, len);
 }
 
 // ---------------------------------------------------------------------------
@@ -104,6 +1843,7 @@ static uint16_t att_read_callback(hci_con_handle_t connection_handle, uint16_t a
                                   uint16_t offset, uint8_t *buffer, uint16_t buffer_size) {
   UNUSED(connection_handle);
 
+#if ROKOT_BLE_MIDI_DIS
   // Manufacturer Name
   if (att_handle == ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_MANUFACTURER_NAME_STRING_01_VALUE_HANDLE) {
     return att_read_callback_handle_blob((const uint8_t *)ble_midi_state.manufacturer,
@@ -115,11 +1855,21 @@ static uint16_t att_read_callback(hci_con_handle_t connection_handle, uint16_t a
     return att_read_callback_handle_blob((const uint8_t *)ble_midi_state.firmware_version,
         strlen(ble_midi_state.firmware_version), offset, buffer, buffer_size);
   }
+#endif
 
+#if ROKOT_BLE_MIDI_BATTERY
   // Battery Level
   if (att_handle == ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_BATTERY_LEVEL_01_VALUE_HANDLE) {
     return att_read_callback_handle_byte(ble_midi_state.battery_level, offset, buffer, buffer_size);
   }
+#endif
+
+#if ROKOT_BLE_MIDI_TELEMETRY
+  // Telemetry
+  if (att_handle == ATT_CHARACTERISTIC_8E6F0002_5A0B_4C3D_9E2F_1B7A6C4D3E20_01_VALUE_HANDLE) {
+    return att_read_callback_handle_blob(telemetry.data, telemetry.len, offset, buffer, buffer_size);
+  }
+#endif
 
   // BLE-MIDI
   if (att_handle == ATT_CHARACTERISTIC_7772E5DB_3868_4112_A1A9_F2669D106BF3_01_VALUE_HANDLE) {
@@ -134,77 +1884,467 @@ static int att_write_callback(hci_con_handle_t connection_handle, uint16_t att_h
   UNUSED(transaction_mode);
   UNUSED(offset);
 
+  ble_midi_connection_t *conn = connection_for_handle(connection_handle);
+  if (!conn) return 0;
+
+#if ROKOT_BLE_MIDI_BATTERY
   // Battery CCCD
   if (att_handle == ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_BATTERY_LEVEL_01_CLIENT_CONFIGURATION_HANDLE) {
-    ble_midi_state.battery_notifications_enabled =
-        (little_endian_read_16(buffer, 0) == GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
-    ble_midi_state.con_handle = connection_handle;
+    low_priority_subscribe(conn, LOW_PRIORITY_BATTERY,
+        little_endian_read_16(buffer, 0) == GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
+    return 0;
+  }
+#endif
+
+#if ROKOT_BLE_MIDI_TELEMETRY
+  // Telemetry CCCD
+  if (att_handle == ATT_CHARACTERISTIC_8E6F0002_5A0B_4C3D_9E2F_1B7A6C4D3E20_01_CLIENT_CONFIGURATION_HANDLE) {
+    low_priority_subscribe(conn, LOW_PRIORITY_TELEMETRY,
+        little_endian_read_16(buffer, 0) == GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
     return 0;
   }
+#endif
 
-  // MIDI CCCD
+  // MIDI CCCD. A peer subscribing starts with messages queued from now on;
+  // one unsubscribing no longer holds back the queue.
   if (att_handle == ATT_CHARACTERISTIC_7772E5DB_3868_4112_A1A9_F2669D106BF3_01_CLIENT_CONFIGURATION_HANDLE) {
-    ble_midi_state.notifications_enabled =
-        (little_endian_read_16(buffer, 0) == GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
-    ble_midi_state.con_handle = connection_handle;
+    bool enabled = (little_endian_read_16(buffer, 0) == GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
+    if (enabled && !conn->notifications_enabled) {
+      conn->tx_pos = tx_queue.count;
+      conn->tx_sysex_offset = 0;
+#if ROKOT_BLE_MIDI_ENABLE_STATS
+      if (ble_midi_stats.reconnect_pending) {
+        uint32_t elapsed_ms = btstack_run_loop_get_time_ms() - ble_midi_stats.disconnected_ms;
+        ble_midi_stats.counters.reconnect_time_last_ms = elapsed_ms;
+        if (elapsed_ms > ble_midi_stats.counters.reconnect_time_max_ms)
+          ble_midi_stats.counters.reconnect_time_max_ms = elapsed_ms;
+        ble_midi_stats.reconnect_pending = false;
+      }
+#endif
+    }
+    conn->notifications_enabled = enabled;
+    tx_queue_release();
     return 0;
   }
 
   // Incoming MIDI
   if (att_handle == ATT_CHARACTERISTIC_7772E5DB_3868_4112_A1A9_F2669D106BF3_01_VALUE_HANDLE) {
-    if (buffer_size > 2 && ble_midi_state.rx_callback) {
-      if (buffer_size >= 5) ble_midi_state.rx_callback(buffer[2], buffer[3], buffer[4]);
-      else if (buffer_size >= 4) ble_midi_state.rx_callback(buffer[2], buffer[3], 0);
-    }
+    rx_raw_deliver(connection_handle, buffer, buffer_size);
+    conn->last_rx_ms = btstack_run_loop_get_time_ms();
+    conn_event_observe(conn);
+    conn_params_wake(conn);
+    rx_parser.con_handle = connection_handle;
+    rx_parser.decoder.in_sysex = conn->rx_in_sysex;
+    decode_ble_midi_packet(buffer, buffer_size);
+    conn->rx_in_sysex = rx_parser.decoder.in_sysex;
     return 0;
   }
 
   return 0;
 }
 
+// ---------------------------------------------------------------------------
+// Central Role
+// ---------------------------------------------------------------------------
+
+#if ROKOT_BLE_MIDI_CENTRAL
+
+// BLE-MIDI service and characteristic, big-endian as BTstack's uuid128 APIs
+// take them (adv_data carries the service UUID little-endian)
+static const uint8_t midi_service_uuid[16] = {
+  0x03, 0xB8, 0x0E, 0x5A, 0xED, 0xE8, 0x4B, 0x33, 0xA7, 0x51, 0x6C, 0xE3, 0x4E, 0xC4, 0xC7, 0x00,
+};
+static const uint8_t midi_characteristic_uuid[16] = {
+  0x77, 0x72, 0xE5, 0xDB, 0x38, 0x68, 0x41, 0x12, 0xA1, 0xA9, 0xF2, 0x66, 0x9D, 0x10, 0x6B, 0xF3,
+};
+
+// One link to a BLE-MIDI peripheral, set up scan -> connect -> discover
+// service -> discover characteristic -> subscribe
+static struct {
+  volatile bool enabled;
+  bool stack_ready;
+  enum {
+    CENTRAL_IDLE = 0,
+    CENTRAL_SCANNING,
+    CENTRAL_CONNECTING,
+    CENTRAL_DISCOVER_SERVICE,
+    CENTRAL_DISCOVER_CHARACTERISTIC,
+    CENTRAL_SUBSCRIBE,
+    CENTRAL_READY,
+  } state;
+  hci_con_handle_t con_handle;
+  bool found;
+  bool rx_in_sysex;
+  gatt_client_service_t service;
+  gatt_client_characteristic_t characteristic;
+  gatt_client_notification_t notification_listener;
+  rokot_ble_midi_packet_callback_t packet_callback;
+} ble_midi_central = {
+  .con_handle = HCI_CON_HANDLE_INVALID,
+};
+
+// Brings the link in line with ble_midi_central.enabled
+static void central_update(void) {
+  if (!ble_midi_central.stack_ready) return;
+
+  if (ble_midi_central.enabled) {
+    if (ble_midi_central.state != CENTRAL_IDLE) return;
+    gap_set_scan_parameters(1, 0x0030, 0x0030);
+    gap_start_scan();
+    ble_midi_central.state = CENTRAL_SCANNING;
+    return;
+  }
+
+  switch (ble_midi_central.state) {
+  case CENTRAL_IDLE:
+    break;
+  case CENTRAL_SCANNING:
+    gap_stop_scan();
+    ble_midi_central.state = CENTRAL_IDLE;
+    break;
+  case CENTRAL_CONNECTING:
+    gap_connect_cancel();
+    ble_midi_central.state = CENTRAL_IDLE;
+    break;
+  default:
+    // Back to idle once the disconnection completes
+    gap_disconnect(ble_midi_central.con_handle);
+    break;
+  }
+}
+
+static void central_handle_advertising_report(const uint8_t *packet) {
+  if (ble_midi_central.state != CENTRAL_SCANNING) return;
+
+  const uint8_t *data = gap_event_advertising_report_get_data(packet);
+  uint8_t data_len = gap_event_advertising_report_get_data_length(packet);
+  if (!ad_data_contains_uuid128(data_len, data, midi_service_uuid)) return;
+
+  bd_addr_t addr;
+  gap_event_advertising_report_get_address(packet, addr);
+  gap_stop_scan();
+  gap_set_connection_parameters(0x0030, 0x0030, ROKOT_BLE_MIDI_CONN_INTERVAL_MIN, ROKOT_BLE_MIDI_CONN_INTERVAL_MAX,
+      0, 100, 0, 0);
+  if (gap_connect(addr, (bd_addr_type_t)gap_event_advertising_report_get_address_type(packet)) == 0) {
+    ble_midi_central.state = CENTRAL_CONNECTING;
+  } else {
+    ble_midi_central.state = CENTRAL_IDLE;
+    central_update();
+  }
+}
+
+static void central_gatt_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
+  UNUSED(channel);
+  UNUSED(size);
+
+  if (packet_type != HCI_EVENT_PACKET) return;
+
+  switch (hci_event_packet_get_type(packet)) {
+  case GATT_EVENT_SERVICE_QUERY_RESULT:
+    gatt_event_service_query_result_get_service(packet, &ble_midi_central.service);
+    ble_midi_central.found = true;
+    break;
+
+  case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT:
+    gatt_event_characteristic_query_result_get_characteristic(packet, &ble_midi_central.characteristic);
+    ble_midi_central.found = true;
+    break;
+
+  case GATT_EVENT_NOTIFICATION: {
+    const uint8_t *value = gatt_event_notification_get_value(packet);
+    uint16_t value_len = gatt_event_notification_get_value_length(packet);
+    rx_raw_deliver(ble_midi_central.con_handle, value, value_len);
+    // The fast path sees the packet as received and may take it over
+    if (ble_midi_central.packet_callback && ble_midi_central.packet_callback(value, value_len)) break;
+    rx_parser.con_handle = ble_midi_central.con_handle;
+    rx_parser.decoder.in_sysex = ble_midi_central.rx_in_sysex;
+    decode_ble_midi_packet(value, value_len);
+    ble_midi_central.rx_in_sysex = rx_parser.decoder.in_sysex;
+    break;
+  }
+
+  case GATT_EVENT_QUERY_COMPLETE: {
+    hci_con_handle_t con_handle = ble_midi_central.con_handle;
+    bool ok = gatt_event_query_complete_get_att_status(packet) == ATT_ERROR_SUCCESS &&
+              (ble_midi_central.found || ble_midi_central.state == CENTRAL_SUBSCRIBE);
+    ble_midi_central.found = false;
+    if (!ok) {
+      gap_disconnect(con_handle);
+      break;
+    }
+
+    switch (ble_midi_central.state) {
+    case CENTRAL_DISCOVER_SERVICE:
+      ble_midi_central.state = CENTRAL_DISCOVER_CHARACTERISTIC;
+      gatt_client_discover_characteristics_for_service_by_uuid128(central_gatt_handler, con_handle,
+          &ble_midi_central.service, midi_characteristic_uuid);
+      break;
+    case CENTRAL_DISCOVER_CHARACTERISTIC:
+      ble_midi_central.state = CENTRAL_SUBSCRIBE;
+      gatt_client_listen_for_characteristic_value_updates(&ble_midi_central.notification_listener,
+          central_gatt_handler, con_handle, &ble_midi_central.characteristic);
+      gatt_client_write_client_characteristic_configuration(central_gatt_handler, con_handle,
+          &ble_midi_central.characteristic, GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
+      break;
+    case CENTRAL_SUBSCRIBE:
+      ble_midi_central.state = CENTRAL_READY;
+      break;
+    default:
+      break;
+    }
+    break;
+  }
+  }
+}
+
+static void central_handle_connection_complete(hci_con_handle_t con_handle) {
+  ble_midi_central.con_handle = con_handle;
+  ble_midi_central.rx_in_sysex = false;
+  ble_midi_central.found = false;
+  ble_midi_central.state = CENTRAL_DISCOVER_SERVICE;
+  // Stopped while the connection was being set up
+  if (!ble_midi_central.enabled) {
+    gap_disconnect(con_handle);
+    return;
+  }
+  if (hci_can_send_command_packet_now())
+    hci_send_cmd(&hci_le_set_data_length, con_handle, ROKOT_BLE_MIDI_LE_DATA_LENGTH, ROKOT_BLE_MIDI_LE_DATA_LENGTH_TIME);
+  // BTstack exchanges the MTU before the first query
+  gatt_client_discover_primary_services_by_uuid128(central_gatt_handler, con_handle, midi_service_uuid);
+}
+
+static void central_handle_disconnection(void) {
+  if (ble_midi_central.state >= CENTRAL_SUBSCRIBE)
+    gatt_client_stop_listening_for_characteristic_value_updates(&ble_midi_central.notification_listener);
+  if (rx_sysex.con_handle == ble_midi_central.con_handle) rx_sysex.active = false;
+  ble_midi_central.con_handle = HCI_CON_HANDLE_INVALID;
+  ble_midi_central.state = CENTRAL_IDLE;
+  // Scans again for the next peripheral while still enabled
+  central_update();
+}
+
+// Forgets the link when the stack goes down; enabled is kept, so the
+// central scans again once the stack is back up after the next init
+static void central_reset(void) {
+  if (ble_midi_central.state >= CENTRAL_SUBSCRIBE)
+    gatt_client_stop_listening_for_characteristic_value_updates(&ble_midi_central.notification_listener);
+  ble_midi_central.stack_ready = false;
+  ble_midi_central.state = CENTRAL_IDLE;
+  ble_midi_central.con_handle = HCI_CON_HANDLE_INVALID;
+  ble_midi_central.found = false;
+  ble_midi_central.rx_in_sysex = false;
+}
+
+#endif // ROKOT_BLE_MIDI_CENTRAL
+
 // ---------------------------------------------------------------------------
 // HCI Event Handler
 // ---------------------------------------------------------------------------
 
+// LE Set PHY goes out once the HCI command slot is free (the data length
+// request usually holds it right after connecting). 2M is only a preference:
+// a central without it keeps the link on 1M.
+static void phy_request(ble_midi_connection_t *conn) {
+#if ROKOT_BLE_MIDI_LE_2M_PHY
+  if (!conn->phy_request_pending || !hci_can_send_command_packet_now()) return;
+  conn->phy_request_pending = false;
+  gap_le_set_phy(conn->con_handle, 0, 0x02, 0x02, 0);
+#else
+  UNUSED(conn);
+#endif
+}
+
 static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
-  UNUSED(size);
   UNUSED(channel);
 
   if (packet_type != HCI_EVENT_PACKET) return;
 
   uint8_t event_type = hci_event_packet_get_type(packet);
+  ble_midi_connection_t *conn;
 
   switch (event_type) {
   case BTSTACK_EVENT_STATE:
     if (btstack_event_state_get_state(packet) == HCI_STATE_WORKING) {
-      bd_addr_t null_addr = {0};
-      gap_advertisements_set_params(0x0020, 0x0040, 0, 0, null_addr, 0x07, 0x00);
-      gap_advertisements_set_data(sizeof(adv_data), adv_data);
-      gap_scan_response_set_data(scan_resp_data_len, scan_resp_data);
-      gap_advertisements_enable(1);
+      // Advertising was set up before power-on; the fast phase is timed
+      // from here
+      boot.stats.hci_working_us = time_us_32();
+      if (adv_schedule.phase == ADV_FAST && !adv_schedule.timer_active)
+        adv_schedule_arm(ROKOT_BLE_MIDI_ADV_FAST_TIMEOUT_MS);
+#if ROKOT_BLE_MIDI_CENTRAL
+      ble_midi_central.stack_ready = true;
+      central_update();
+#endif
     }
     break;
 
+#if ROKOT_BLE_MIDI_CENTRAL
+  case GAP_EVENT_ADVERTISING_REPORT:
+    central_handle_advertising_report(packet);
+    break;
+#endif
+
   case HCI_EVENT_LE_META:
     switch (hci_event_le_meta_get_subevent_code(packet)) {
-    case HCI_SUBEVENT_LE_CONNECTION_COMPLETE:
-      ble_midi_state.con_handle = hci_subevent_le_connection_complete_get_connection_handle(packet);
-      ble_midi_state.connection_interval = hci_subevent_le_connection_complete_get_conn_interval(packet);
-      gap_request_connection_parameter_update(ble_midi_state.con_handle,
-          ROKOT_BLE_MIDI_CONN_INTERVAL_MIN, ROKOT_BLE_MIDI_CONN_INTERVAL_MAX, 0, 100);
+    case HCI_SUBEVENT_LE_CONNECTION_COMPLETE: {
+      if (hci_subevent_le_connection_complete_get_status(packet) != 0) {
+        if (hci_subevent_le_connection_complete_get_status(packet) == ERROR_CODE_ADVERTISING_TIMEOUT &&
+            adv_schedule.phase == ADV_DIRECTED) {
+          adv_schedule_set(ADV_FAST);
+          break;
+        }
+#if ROKOT_BLE_MIDI_CENTRAL
+        if (ble_midi_central.state == CENTRAL_CONNECTING) {
+          ble_midi_central.state = CENTRAL_IDLE;
+          central_update();
+        }
+#endif
+        break;
+      }
+      hci_con_handle_t con_handle = hci_subevent_le_connection_complete_get_connection_handle(packet);
+#if ROKOT_BLE_MIDI_CENTRAL
+      if (hci_subevent_le_connection_complete_get_role(packet) == HCI_ROLE_MASTER) {
+        central_handle_connection_complete(con_handle);
+        break;
+      }
+#endif
+      conn = connection_alloc(con_handle);
+      if (!conn) {
+        gap_disconnect(con_handle);
+        break;
+      }
+      hci_subevent_le_connection_complete_get_peer_address(packet, conn->peer_addr);
+      conn->peer_addr_type = hci_subevent_le_connection_complete_get_peer_address_type(packet);
+      // Further slots, if any, are advertised fast again
+      adv_schedule_set(ADV_FAST);
+#if ROKOT_BLE_MIDI_ENABLE_STATS
+      if (ble_midi_stats.connected_before) ble_midi_stats.counters.reconnects++;
+      ble_midi_stats.connected_before = true;
+#endif
+      conn->connection_interval = hci_subevent_le_connection_complete_get_conn_interval(packet);
+      conn->conn_latency = hci_subevent_le_connection_complete_get_conn_latency(packet);
+      conn->last_rx_ms = btstack_run_loop_get_time_ms();
+      // params_idle starts out matching idle, so force the first request
+      conn->params_idle = true;
+      conn_params_apply(conn);
+      conn_policy_start();
+      // Most centrals start the MTU exchange themselves; asking as well covers
+      // the ones that never do
+      gatt_client_send_mtu_negotiation(&packet_handler, con_handle);
+      if (hci_can_send_command_packet_now())
+        hci_send_cmd(&hci_le_set_data_length, con_handle,
+            ROKOT_BLE_MIDI_LE_DATA_LENGTH, ROKOT_BLE_MIDI_LE_DATA_LENGTH_TIME);
+      conn->phy_request_pending = true;
+      phy_request(conn);
       break;
+    }
     case HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE:
-      ble_midi_state.connection_interval = hci_subevent_le_connection_update_complete_get_conn_interval(packet);
+      conn = connection_for_handle(hci_subevent_le_connection_update_complete_get_connection_handle(packet));
+      if (!conn) break;
+      conn->connection_interval = hci_subevent_le_connection_update_complete_get_conn_interval(packet);
+      conn->conn_latency = hci_subevent_le_connection_update_complete_get_conn_latency(packet);
+      conn->event_anchor_valid = false;
+      // Granted something else than the settled request asked for
+      if (!conn->params_pending && conn->params_idle == conn->idle && !conn_params_granted(conn)) {
+        conn_params_retry(conn);
+        conn_params_apply(conn);
+      }
+      break;
+    case HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE:
+      conn = connection_for_handle(hci_subevent_le_phy_update_complete_get_connection_handle(packet));
+      if (!conn || hci_subevent_le_phy_update_complete_get_status(packet) != 0) break;
+      conn->tx_phy = hci_subevent_le_phy_update_complete_get_tx_phy(packet);
+      conn->rx_phy = hci_subevent_le_phy_update_complete_get_rx_phy(packet);
+      break;
+    case HCI_SUBEVENT_LE_DATA_LENGTH_CHANGE:
+      conn = connection_for_handle(hci_subevent_le_data_length_change_get_connection_handle(packet));
+      if (conn) conn->data_length = hci_subevent_le_data_length_change_get_max_tx_octets(packet);
+      break;
+    }
+    break;
+
+  case HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS:
+    conn_event_handle_completed_packets(packet, size);
+    break;
+
+  case HCI_EVENT_COMMAND_COMPLETE:
+    boot_handle_command_complete(packet);
+    // fall through
+  case HCI_EVENT_COMMAND_STATUS:
+    for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++)
+      if (ble_midi_state.connections[i].in_use) phy_request(&ble_midi_state.connections[i]);
+    break;
+
+  // Accepted or rejected, the next request can go out. A rejected request
+  // for the current target is repeated from the next activity or policy
+  // timer tick, a bounded number of times; a target that changed meanwhile
+  // is requested straight away.
+  case L2CAP_EVENT_CONNECTION_PARAMETER_UPDATE_RESPONSE:
+    conn = connection_for_handle(l2cap_event_connection_parameter_update_response_get_handle(packet));
+    if (!conn) break;
+    conn->params_pending = false;
+    if (l2cap_event_connection_parameter_update_response_get_result(packet) != 0 && conn->params_idle == conn->idle) {
+      conn_params_retry(conn);
       break;
     }
+    conn_params_apply(conn);
+    break;
+
+  case ATT_EVENT_MTU_EXCHANGE_COMPLETE:
+    conn = connection_for_handle(att_event_mtu_exchange_complete_get_handle(packet));
+    if (conn) conn->mtu = att_event_mtu_exchange_complete_get_MTU(packet);
+    break;
+
+  case GATT_EVENT_MTU:
+    conn = connection_for_handle(gatt_event_mtu_get_handle(packet));
+    if (conn) conn->mtu = gatt_event_mtu_get_MTU(packet);
+    break;
+
+  case ATT_EVENT_CAN_SEND_NOW:
+    conn = connection_for_handle(att_event_can_send_now_get_handle(packet));
+    if (!conn) break;
+    conn->send_requested = false;
+    tx_flush(conn);
     break;
 
   case HCI_EVENT_DISCONNECTION_COMPLETE:
-    ble_midi_state.con_handle = HCI_CON_HANDLE_INVALID;
-    ble_midi_state.notifications_enabled = false;
-    ble_midi_state.battery_notifications_enabled = false;
-    ble_midi_state.connection_interval = 0;
-    gap_advertisements_enable(1);
+#if ROKOT_BLE_MIDI_CENTRAL
+    if (hci_event_disconnection_complete_get_connection_handle(packet) == ble_midi_central.con_handle) {
+      central_handle_disconnection();
+      break;
+    }
+#endif
+    conn = connection_for_handle(hci_event_disconnection_complete_get_connection_handle(packet));
+    if (!conn) break;
+    if (rx_sysex.con_handle == conn->con_handle) rx_sysex.active = false;
+#if ROKOT_BLE_MIDI_LATE_FLUSH_US
+    conn_flush_cancel(conn);
+#endif
+    conn->in_use = false;
+    tx_queue_release();
+#if ROKOT_BLE_MIDI_ENABLE_STATS
+    ble_midi_stats.disconnected_ms = btstack_run_loop_get_time_ms();
+    ble_midi_stats.reconnect_pending = true;
+#endif
+    // BTstack keeps advertising while below the peripheral connection limit
+    // set in ble_stack_init(); enabling it again covers the limit having
+    // been reached
+    adv_schedule_after_disconnect(conn, hci_event_disconnection_complete_get_reason(packet));
+    break;
+
+  case SM_EVENT_JUST_WORKS_REQUEST:
+    sm_just_works_confirm(sm_event_just_works_request_get_handle(packet));
+    break;
+
+  // A bonded central is one that paired with bonding just now or whose
+  // address resolved against the stored keys
+  case SM_EVENT_PAIRING_COMPLETE:
+    conn = connection_for_handle(sm_event_pairing_complete_get_handle(packet));
+    if (conn && sm_event_pairing_complete_get_status(packet) == ERROR_CODE_SUCCESS) conn->bonded = ROKOT_BLE_MIDI_BONDING;
+    break;
+
+  case SM_EVENT_IDENTITY_RESOLVING_SUCCEEDED:
+    conn = connection_for_handle(sm_event_identity_resolving_succeeded_get_handle(packet));
+    if (conn) conn->bonded = true;
     break;
   }
 }
@@ -213,120 +2353,393 @@ static void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packe
 // Public API
 // ---------------------------------------------------------------------------
 
-int rokot_ble_midi_init(const char *device_name) {
-  if (ble_midi_state.initialized) return -1;
-
-  strncpy(ble_midi_state.device_name, device_name, sizeof(ble_midi_state.device_name) - 1);
-  ble_midi_state.device_name[sizeof(ble_midi_state.device_name) - 1] = '\0';
-  build_scan_response(device_name);
-
+static int ble_stack_init(void) {
   if (cyw43_arch_init()) return -2;
+  boot.stats.cyw43_ready_us = time_us_32();
 
   l2cap_init();
+  l2cap_set_max_le_mtu(ROKOT_BLE_MIDI_ATT_MTU);
+  gap_set_max_number_peripheral_connections(ROKOT_BLE_MIDI_MAX_CONNECTIONS);
   sm_init();
+#if ROKOT_BLE_MIDI_BONDING
+  // Keys go to the flash TLV store the CYW43 port sets up
+  sm_set_io_capabilities(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+#if ROKOT_BLE_MIDI_SECURE_CONNECTIONS
+  sm_set_authentication_requirements(SM_AUTHREQ_SECURE_CONNECTION | SM_AUTHREQ_BONDING);
+#else
+  sm_set_authentication_requirements(SM_AUTHREQ_BONDING);
+#endif
+#endif
   att_server_init(profile_data, att_read_callback, att_write_callback);
+  gatt_client_init();
 
   ble_midi_state.hci_event_callback_registration.callback = &packet_handler;
   hci_add_event_handler(&ble_midi_state.hci_event_callback_registration);
+  ble_midi_state.sm_event_callback_registration.callback = &packet_handler;
+  sm_add_event_handler(&ble_midi_state.sm_event_callback_registration);
   att_server_register_packet_handler(packet_handler);
 
-  hci_power_control(HCI_POWER_ON);
+  gap_advertisements_set_data(sizeof(adv_data), adv_data);
+  gap_scan_response_set_data(scan_resp_data_len, scan_resp_data);
+  adv_schedule_apply(ADV_FAST);
+
+  boot_power_on();
+  return 0;
+}
+
+static void ble_stack_deinit(void) {
+  if (conn_policy.timer_active) btstack_run_loop_remove_timer(&conn_policy.timer);
+  conn_policy.timer_active = false;
+  if (ble_midi_clock.timer_active) btstack_run_loop_remove_timer(&ble_midi_clock.timer);
+  ble_midi_clock.timer_active = false;
+  ble_midi_clock.running = false;
+  ble_midi_clock.request = 0;
+  ble_midi_clock.next_tick_q8 = 0;
+  if (adv_schedule.timer_active) btstack_run_loop_remove_timer(&adv_schedule.timer);
+  adv_schedule.timer_active = false;
+#if ROKOT_BLE_MIDI_LATE_FLUSH_US
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++) conn_flush_cancel(&ble_midi_state.connections[i]);
+#endif
+#if ROKOT_BLE_MIDI_ASYNC_INIT
+  if (boot.power_timer_active) btstack_run_loop_remove_timer(&boot.power_timer);
+  boot.power_timer_active = false;
+#endif
+#if ROKOT_BLE_MIDI_CENTRAL
+  central_reset();
+#endif
+  hci_power_control(HCI_POWER_OFF);
+  cyw43_arch_deinit();
+}
+
+#if ROKOT_BLE_MIDI_MULTICORE
+static void core1_main(void) {
+  if (ble_stack_init() != 0) {
+    core1_status = CORE1_FAILED;
+    return;
+  }
+  core1_status = CORE1_RUNNING;
+
+  // The wait returns early on BLE work or on the __sev() issued by core 0
+  // after pushing to the TX ring
+  while (core1_status == CORE1_RUNNING) {
+    async_context_poll(cyw43_arch_async_context());
+    core_tx_drain();
+    async_context_wait_for_work_until(cyw43_arch_async_context(), make_timeout_time_ms(1));
+  }
+
+  ble_stack_deinit();
+  core1_status = CORE1_STOPPED;
+}
+#endif
+
+int rokot_ble_midi_init(const char *device_name) {
+  if (ble_midi_state.initialized) return -1;
+
+  memset(&boot.stats, 0, sizeof(boot.stats));
+  boot.stats.init_us = time_us_32();
+  build_scan_response(device_name);
+
+#if ROKOT_BLE_MIDI_MULTICORE
+  core1_status = CORE1_STARTING;
+  multicore_launch_core1(core1_main);
+  while (core1_status == CORE1_STARTING) tight_loop_contents();
+  if (core1_status != CORE1_RUNNING) {
+    multicore_reset_core1();
+    return -2;
+  }
+#else
+  int result = ble_stack_init();
+  if (result != 0) return result;
+#endif
+
+#if ROKOT_BLE_MIDI_USB
+  tusb_init();
+#endif
+
   ble_midi_state.initialized = true;
   return 0;
 }
 
 void rokot_ble_midi_deinit(void) {
   if (!ble_midi_state.initialized) return;
-  hci_power_control(HCI_POWER_OFF);
-  cyw43_arch_deinit();
+#if ROKOT_BLE_MIDI_MULTICORE
+  core1_status = CORE1_STOP_REQUESTED;
+  __sev();
+  while (core1_status != CORE1_STOPPED) tight_loop_contents();
+  multicore_reset_core1();
+  core_tx.head = core_tx.tail = 0;
+  core_tx.sysex_data = NULL;
+#else
+  ble_stack_deinit();
+#endif
+#if RX_DEFERRED
+  rx_queue.head = rx_queue.tail = 0;
+  rx_sysex.delivering = false;
+#endif
   ble_midi_state.initialized = false;
-  ble_midi_state.con_handle = HCI_CON_HANDLE_INVALID;
-  ble_midi_state.notifications_enabled = false;
-  ble_midi_state.battery_notifications_enabled = false;
+  memset(ble_midi_state.connections, 0, sizeof(ble_midi_state.connections));
+  tx_queue_clear();
+  rx_sysex.active = false;
 }
 
 void rokot_ble_midi_task(void) {
   if (!ble_midi_state.initialized) return;
+#if ROKOT_BLE_MIDI_USB
+  usb_bridge_task();
+#endif
+#if !ROKOT_BLE_MIDI_MULTICORE && !ROKOT_BLE_MIDI_BACKGROUND
   async_context_poll(cyw43_arch_async_context());
+#endif
+#if ROKOT_BLE_MIDI_RAW_RX_BUFFER
+  rx_raw_drain();
+#endif
+#if RX_DEFERRED
+  rx_queue_drain();
+#endif
+#if !ROKOT_BLE_MIDI_MULTICORE && !ROKOT_BLE_MIDI_BACKGROUND
   async_context_wait_for_work_until(cyw43_arch_async_context(), make_timeout_time_ms(1));
+#endif
+}
+
+void rokot_ble_midi_poll(void) {
+  if (!ble_midi_state.initialized) return;
+#if ROKOT_BLE_MIDI_USB
+  usb_bridge_task();
+#endif
+#if !ROKOT_BLE_MIDI_MULTICORE && !ROKOT_BLE_MIDI_BACKGROUND
+  async_context_poll(cyw43_arch_async_context());
+#endif
+#if ROKOT_BLE_MIDI_RAW_RX_BUFFER
+  rx_raw_drain();
+#endif
+#if RX_DEFERRED
+  rx_queue_drain();
+#endif
 }
 
 rokot_ble_midi_state_t rokot_ble_midi_get_state(void) {
-  if (ble_midi_state.notifications_enabled) return ROKOT_BLE_MIDI_READY;
-  if (ble_midi_state.con_handle != HCI_CON_HANDLE_INVALID) return ROKOT_BLE_MIDI_CONNECTED;
+  if (ble_midi_any_ready()) return ROKOT_BLE_MIDI_READY;
+  if (connection_first()) return ROKOT_BLE_MIDI_CONNECTED;
   return ROKOT_BLE_MIDI_DISCONNECTED;
 }
 
 bool rokot_ble_midi_is_ready(void) {
-  return ble_midi_state.notifications_enabled && ble_midi_state.con_handle != HCI_CON_HANDLE_INVALID;
+  return ble_midi_any_ready();
 }
 
 bool rokot_ble_midi_is_connected(void) {
-  return ble_midi_state.con_handle != HCI_CON_HANDLE_INVALID;
+  return connection_first() != NULL;
+}
+
+uint8_t rokot_ble_midi_get_connection_count(void) {
+  uint8_t count = 0;
+  for (int i = 0; i < ROKOT_BLE_MIDI_MAX_CONNECTIONS; i++)
+    if (ble_midi_state.connections[i].in_use) count++;
+  return count;
 }
 
 float rokot_ble_midi_get_connection_interval(void) {
-  return ble_midi_state.connection_interval * 1.25f;
+  const ble_midi_connection_t *conn = connection_first();
+  return conn ? conn->connection_interval * 1.25f : 0.0f;
+}
+
+uint16_t rokot_ble_midi_get_peripheral_latency(void) {
+  const ble_midi_connection_t *conn = connection_first();
+  return conn ? conn->conn_latency : 0;
+}
+
+float rokot_ble_midi_get_effective_latency(void) {
+  const ble_midi_connection_t *conn = connection_first();
+  return conn ? conn->connection_interval * 1.25f * (conn->conn_latency + 1) : 0.0f;
+}
+
+int32_t rokot_ble_midi_get_time_to_next_event_us(void) {
+  const ble_midi_connection_t *conn = connection_first();
+  return conn ? conn_event_time_to_next_us(conn) : -1;
+}
+
+void rokot_ble_midi_set_conn_policy(const rokot_ble_midi_conn_policy_t *policy) {
+  rokot_ble_midi_conn_policy_t p = *policy;
+  if (p.idle_interval_min < 6) p.idle_interval_min = 6;
+  if (p.idle_interval_max < p.idle_interval_min) p.idle_interval_max = p.idle_interval_min;
+  if (p.idle_interval_max > 3200) p.idle_interval_max = 3200;
+  if (p.idle_interval_min > p.idle_interval_max) p.idle_interval_min = p.idle_interval_max;
+  // The supervision timeout has to outlast two missed connection events
+  // at the longest interval: (1 + latency) * interval * 2 < timeout
+  uint32_t max_latency = ((uint32_t)ROKOT_BLE_MIDI_SUPERVISION_TIMEOUT * 4 - 1) / p.idle_interval_max;
+  max_latency = max_latency > 0 ? max_latency - 1 : 0;
+  if (max_latency > 499) max_latency = 499;
+  if (p.idle_latency > max_latency) p.idle_latency = (uint16_t)max_latency;
+
+#if ROKOT_BLE_MIDI_MULTICORE
+  conn_policy.requested = p;
+  __dmb();
+  conn_policy.dirty = true;
+  __sev();
+#else
+  ble_midi_lock();
+  conn_policy.policy = p;
+  conn_policy_update();
+  ble_midi_unlock();
+#endif
+}
+
+void rokot_ble_midi_get_conn_policy(rokot_ble_midi_conn_policy_t *policy) {
+  *policy = conn_policy.policy;
+}
+
+uint8_t rokot_ble_midi_get_phy(void) {
+  const ble_midi_connection_t *conn = connection_first();
+  return conn ? conn->tx_phy : 0;
+}
+
+uint16_t rokot_ble_midi_get_mtu(void) {
+  const ble_midi_connection_t *conn = connection_first();
+  return conn ? conn->mtu : ATT_DEFAULT_MTU;
+}
+
+uint16_t rokot_ble_midi_get_data_length(void) {
+  const ble_midi_connection_t *conn = connection_first();
+  return conn ? conn->data_length : 27;
 }
 
 // Device Information
 void rokot_ble_midi_set_manufacturer(const char *manufacturer) {
+#if ROKOT_BLE_MIDI_DIS
   strncpy(ble_midi_state.manufacturer, manufacturer, sizeof(ble_midi_state.manufacturer) - 1);
   ble_midi_state.manufacturer[sizeof(ble_midi_state.manufacturer) - 1] = '\0';
+#else
+  UNUSED(manufacturer);
+#endif
 }
 
 void rokot_ble_midi_set_firmware_version(const char *version) {
+#if ROKOT_BLE_MIDI_DIS
   strncpy(ble_midi_state.firmware_version, version, sizeof(ble_midi_state.firmware_version) - 1);
   ble_midi_state.firmware_version[sizeof(ble_midi_state.firmware_version) - 1] = '\0';
+#else
+  UNUSED(version);
+#endif
 }
 
 // Battery
 void rokot_ble_midi_set_battery_level(uint8_t level) {
   if (level > 100) level = 100;
-  ble_midi_state.battery_level = level;
 
-  if (ble_midi_state.battery_notifications_enabled &&
-      ble_midi_state.con_handle != HCI_CON_HANDLE_INVALID &&
-      att_server_can_send_packet_now(ble_midi_state.con_handle)) {
-    att_server_notify(ble_midi_state.con_handle,
-        ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_BATTERY_LEVEL_01_VALUE_HANDLE, &level, 1);
-  }
+#if ROKOT_BLE_MIDI_MULTICORE
+  ble_midi_state.battery_level = level;
+  core_tx.battery_dirty = true;
+  __sev();
+#else
+  ble_midi_lock();
+  ble_midi_state.battery_level = level;
+  low_priority_mark(LOW_PRIORITY_BATTERY);
+  ble_midi_unlock();
+#endif
 }
 
 uint8_t rokot_ble_midi_get_battery_level(void) {
   return ble_midi_state.battery_level;
 }
 
+// Telemetry
+int rokot_ble_midi_set_telemetry(const uint8_t *data, uint16_t len) {
+#if ROKOT_BLE_MIDI_TELEMETRY
+  if (len > ROKOT_BLE_MIDI_TELEMETRY_SIZE || (len && !data)) return -1;
+
+#if ROKOT_BLE_MIDI_MULTICORE
+  telemetry.seq++;
+  __dmb();
+  if (len) memcpy(telemetry.staged, data, len);
+  telemetry.staged_len = len;
+  __dmb();
+  telemetry.seq++;
+  core_tx.telemetry_dirty = true;
+  __sev();
+#else
+  ble_midi_lock();
+  if (len) memcpy(telemetry.data, data, len);
+  telemetry.len = len;
+  low_priority_mark(LOW_PRIORITY_TELEMETRY);
+  ble_midi_unlock();
+#endif
+  return 0;
+#else
+  UNUSED(data);
+  UNUSED(len);
+  return -1;
+#endif
+}
+
 // MIDI
-int rokot_ble_midi_note_on(uint8_t channel, uint8_t note, uint8_t velocity) {
-  uint8_t midi[3] = {(uint8_t)(MIDI_NOTE_ON | (channel & 0x0F)), note & 0x7F, velocity & 0x7F};
-  return send_midi_internal(midi, 3);
+// Program change and channel pressure (0xC0-0xDF) carry one data byte
+int SEND_PATH_FUNC(rokot_ble_midi_send_message)(uint8_t status, uint8_t data1, uint8_t data2) {
+  if (status < 0x80 || status >= 0xF0) return -1;
+  uint8_t midi[3] = {status, (uint8_t)(data1 & 0x7F), (uint8_t)(data2 & 0x7F)};
+  return send_midi_internal(midi, (status & 0xE0) == 0xC0 ? 2 : 3);
+}
+
+// Compound messages go out as one batch, so the receiver never sees half of
+// a parameter change and running status packs them into one notification
+
+static rokot_midi_msg_t cc_msg(uint8_t channel, uint8_t controller, uint8_t value) {
+  rokot_midi_msg_t msg = {(uint8_t)(MIDI_CONTROL_CHANGE | (channel & 0x0F)), controller, (uint8_t)(value & 0x7F)};
+  return msg;
+}
+
+int rokot_ble_midi_control_change_14bit(uint8_t channel, uint8_t controller, uint16_t value) {
+  if (controller >= 32) return -1;
+  rokot_midi_msg_t msgs[2] = {
+    cc_msg(channel, controller, (uint8_t)(value >> 7)),
+    cc_msg(channel, (uint8_t)(controller + 32), (uint8_t)value),
+  };
+  return send_batch_internal(msgs, 2);
 }
 
-int rokot_ble_midi_note_off(uint8_t channel, uint8_t note) {
-  uint8_t midi[3] = {(uint8_t)(MIDI_NOTE_OFF | (channel & 0x0F)), note & 0x7F, 0};
-  return send_midi_internal(midi, 3);
+static int send_parameter_number(uint8_t channel, uint8_t cc_msb, uint16_t parameter, uint16_t value) {
+  rokot_midi_msg_t msgs[4] = {
+    cc_msg(channel, cc_msb, (uint8_t)(parameter >> 7)),
+    cc_msg(channel, (uint8_t)(cc_msb - 1), (uint8_t)parameter),
+    cc_msg(channel, MIDI_CC_DATA_ENTRY_MSB, (uint8_t)(value >> 7)),
+    cc_msg(channel, MIDI_CC_DATA_ENTRY_LSB, (uint8_t)value),
+  };
+  return send_batch_internal(msgs, 4);
 }
 
-int rokot_ble_midi_control_change(uint8_t channel, uint8_t controller, uint8_t value) {
-  uint8_t midi[3] = {(uint8_t)(MIDI_CONTROL_CHANGE | (channel & 0x0F)), controller & 0x7F, value & 0x7F};
-  return send_midi_internal(midi, 3);
+int rokot_ble_midi_rpn(uint8_t channel, uint16_t parameter, uint16_t value) {
+  return send_parameter_number(channel, MIDI_CC_RPN_MSB, parameter, value);
 }
 
-int rokot_ble_midi_program_change(uint8_t channel, uint8_t program) {
-  uint8_t midi[2] = {(uint8_t)(MIDI_PROGRAM_CHANGE | (channel & 0x0F)), program & 0x7F};
-  return send_midi_internal(midi, 2);
+int rokot_ble_midi_nrpn(uint8_t channel, uint16_t parameter, uint16_t value) {
+  return send_parameter_number(channel, MIDI_CC_NRPN_MSB, parameter, value);
 }
 
-int rokot_ble_midi_pitch_bend(uint8_t channel, int16_t value) {
-  uint16_t bend = (uint16_t)(value + 8192);
-  uint8_t midi[3] = {(uint8_t)(MIDI_PITCH_BEND | (channel & 0x0F)), (uint8_t)(bend & 0x7F), (uint8_t)((bend >> 7) & 0x7F)};
-  return send_midi_internal(midi, 3);
+// MPE Configuration Message: RPN 6 on the zone's manager channel, member
+// count in the data entry MSB. 0 members turns the zone off.
+int rokot_ble_midi_mpe_configure(uint8_t manager_channel, uint8_t member_channels) {
+  if ((manager_channel != 0 && manager_channel != 15) || member_channels > 15) return -1;
+  rokot_midi_msg_t msgs[3] = {
+    cc_msg(manager_channel, MIDI_CC_RPN_MSB, 0),
+    cc_msg(manager_channel, MIDI_CC_RPN_LSB, 6),
+    cc_msg(manager_channel, MIDI_CC_DATA_ENTRY_MSB, member_channels),
+  };
+  return send_batch_internal(msgs, 3);
 }
 
-int rokot_ble_midi_channel_pressure(uint8_t channel, uint8_t pressure) {
-  uint8_t midi[2] = {(uint8_t)(MIDI_CHANNEL_PRESSURE | (channel & 0x0F)), pressure & 0x7F};
-  return send_midi_internal(midi, 2);
+// The member channel's pitch bend, timbre and pressure are set before the
+// note starts, in the same packet, so the note never sounds with the
+// previous note's expression
+int rokot_ble_midi_mpe_note_on(uint8_t channel, uint8_t note, uint8_t velocity,
+                               int16_t pitch_bend, uint8_t timbre, uint8_t pressure) {
+  uint16_t bend = (uint16_t)(pitch_bend + 8192);
+  uint8_t status_channel = channel & 0x0F;
+  rokot_midi_msg_t msgs[4] = {
+    {(uint8_t)(MIDI_PITCH_BEND | status_channel), (uint8_t)(bend & 0x7F), (uint8_t)((bend >> 7) & 0x7F)},
+    cc_msg(channel, MIDI_CC_MPE_TIMBRE, timbre),
+    {(uint8_t)(MIDI_CHANNEL_PRESSURE | status_channel), (uint8_t)(pressure & 0x7F), 0},
+    {(uint8_t)(MIDI_NOTE_ON | status_channel), (uint8_t)(note & 0x7F), (uint8_t)(velocity & 0x7F)},
+  };
+  return send_batch_internal(msgs, 4);
 }
 
 int rokot_ble_midi_send_raw(const uint8_t *data, uint8_t len) {
@@ -334,6 +2747,244 @@ int rokot_ble_midi_send_raw(const uint8_t *data, uint8_t len) {
   return send_midi_internal(data, len);
 }
 
+int rokot_ble_midi_send_batch(const rokot_midi_msg_t *msgs, size_t n) {
+  if (!msgs || n == 0 || n > ROKOT_BLE_MIDI_BATCH_MAX) return -1;
+  for (size_t i = 0; i < n; i++) {
+    if (!(msgs[i].status & 0x80) || rokot_ble_midi_codec_data_len(msgs[i].status) < 0) return -1;
+  }
+  return send_batch_internal(msgs, n);
+}
+
+// SysEx
+int rokot_ble_midi_send_sysex(const uint8_t *data, size_t len) {
+  if (!data || len < 2 || data[0] != 0xF0 || data[len - 1] != 0xF7) return -1;
+  for (size_t i = 1; i < len - 1; i++) {
+    if (data[i] & 0x80) return -1;
+  }
+  return send_sysex_internal(&data[1], len - 2);
+}
+
+bool rokot_ble_midi_is_sysex_busy(void) {
+#if ROKOT_BLE_MIDI_MULTICORE
+  if (core_tx.sysex_data) return true;
+#endif
+  return tx_sysex.data != NULL;
+}
+
+void rokot_ble_midi_set_sysex_callback(uint8_t *buffer, size_t size, rokot_ble_midi_sysex_callback_t callback) {
+  rx_sysex.buffer = buffer;
+  rx_sysex.size = size;
+  rx_sysex.len = 0;
+  rx_sysex.callback = callback;
+}
+
+// Transmit Queue
+// In dual-core mode these report the ring core 0 pushes into
+uint16_t rokot_ble_midi_get_tx_queue_free(void) {
+#if ROKOT_BLE_MIDI_MULTICORE
+  return core_tx_free();
+#else
+  return tx_queue_free();
+#endif
+}
+
+uint16_t rokot_ble_midi_get_tx_queue_high_water(void) {
+#if ROKOT_BLE_MIDI_MULTICORE
+  return core_tx.high_water;
+#else
+  return tx_queue.high_water;
+#endif
+}
+
+void rokot_ble_midi_reset_tx_queue_high_water(void) {
+#if ROKOT_BLE_MIDI_MULTICORE
+  core_tx.high_water = core_tx_count();
+#else
+  tx_queue.high_water = tx_queue.count;
+#endif
+}
+
+void rokot_ble_midi_set_collapse(uint8_t types) {
+  ble_midi_state.collapse_types = types;
+}
+
 void rokot_ble_midi_set_callback(rokot_ble_midi_callback_t callback) {
   ble_midi_state.rx_callback = callback;
 }
+
+void rokot_ble_midi_set_timestamped_callback(rokot_ble_midi_timestamped_callback_t callback) {
+  ble_midi_state.rx_timestamped_callback = callback;
+}
+
+int rokot_ble_midi_set_raw_callback(rokot_ble_midi_raw_callback_t callback, bool deferred) {
+#if !ROKOT_BLE_MIDI_RAW_RX_BUFFER
+  if (deferred) return -1;
+#endif
+  rx_raw.deferred = deferred;
+  rx_raw.callback = callback;
+  return 0;
+}
+
+// MIDI Clock
+int rokot_ble_midi_clock_start(float bpm) {
+  if (!ble_midi_state.initialized) return -1;
+  ble_midi_clock.period_q8 = clock_period_q8(bpm);
+  clock_request(0xFA, true);
+  return 0;
+}
+
+int rokot_ble_midi_clock_continue(float bpm) {
+  if (!ble_midi_state.initialized) return -1;
+  ble_midi_clock.period_q8 = clock_period_q8(bpm);
+  clock_request(0xFB, true);
+  return 0;
+}
+
+void rokot_ble_midi_clock_stop(void) {
+  if (!ble_midi_state.initialized) return;
+  clock_request(0xFC, false);
+}
+
+// Takes effect from the next tick
+void rokot_ble_midi_clock_set_tempo(float bpm) {
+  ble_midi_clock.period_q8 = clock_period_q8(bpm);
+}
+
+bool rokot_ble_midi_clock_is_running(void) {
+  return ble_midi_clock.running;
+}
+
+float rokot_ble_midi_get_rx_tempo(void) {
+  uint32_t interval_us = rx_clock.interval_us;
+  if (interval_us == 0 || time_us_32() - rx_clock.last_us >= 1000000) return 0.0f;
+  return 60000000.0f / ((float)interval_us * 24.0f);
+}
+
+#if ROKOT_BLE_MIDI_CENTRAL
+// Central Role
+static void central_set_enabled(bool enabled) {
+  ble_midi_central.enabled = enabled;
+#if ROKOT_BLE_MIDI_MULTICORE
+  core_tx.central_dirty = true;
+  __sev();
+#else
+  ble_midi_lock();
+  central_update();
+  ble_midi_unlock();
+#endif
+}
+
+int rokot_ble_midi_central_start(void) {
+  if (!ble_midi_state.initialized) return -1;
+  central_set_enabled(true);
+  return 0;
+}
+
+void rokot_ble_midi_central_stop(void) {
+  if (!ble_midi_state.initialized) return;
+  central_set_enabled(false);
+}
+
+bool rokot_ble_midi_central_is_connected(void) {
+  return ble_midi_central.state == CENTRAL_READY;
+}
+
+void rokot_ble_midi_set_central_packet_callback(rokot_ble_midi_packet_callback_t callback) {
+  ble_midi_central.packet_callback = callback;
+}
+#endif
+
+// Statistics
+#if ROKOT_BLE_MIDI_MULTICORE && ROKOT_BLE_MIDI_ENABLE_STATS
+// Core 0: has core 1 carry out request within its next loop, or does it
+// directly while core 1 is not running
+static void core_stats_request(uint8_t request) {
+  if (core1_status != CORE1_RUNNING) {
+    if (request == CORE_STATS_SNAPSHOT)
+      stats_snapshot(&ble_midi_stats.snapshot);
+    else
+      stats_reset();
+    return;
+  }
+  core_tx.stats_request = request;
+  __sev();
+  while (core_tx.stats_request != CORE_STATS_NONE && core1_status == CORE1_RUNNING) tight_loop_contents();
+  __dmb();
+}
+#endif
+
+void rokot_ble_midi_get_stats(rokot_ble_midi_stats_t *stats) {
+#if ROKOT_BLE_MIDI_ENABLE_STATS && ROKOT_BLE_MIDI_MULTICORE
+  core_stats_request(CORE_STATS_SNAPSHOT);
+  *stats = ble_midi_stats.snapshot;
+  stats->tx_dropped += ble_midi_stats.tx_dropped_core0;
+#elif ROKOT_BLE_MIDI_ENABLE_STATS
+  ble_midi_lock();
+  stats_snapshot(stats);
+  ble_midi_unlock();
+#else
+  memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void rokot_ble_midi_reset_stats(void) {
+#if ROKOT_BLE_MIDI_ENABLE_STATS && ROKOT_BLE_MIDI_MULTICORE
+  core_stats_request(CORE_STATS_RESET);
+  ble_midi_stats.tx_dropped_core0 = 0;
+#elif ROKOT_BLE_MIDI_ENABLE_STATS
+  ble_midi_lock();
+  stats_reset();
+  ble_midi_unlock();
+#endif
+}
+
+// Boot
+void rokot_ble_midi_get_boot_stats(rokot_ble_midi_boot_stats_t *stats) {
+  *stats = boot.stats;
+}
+
+void rokot_ble_midi_set_advertising_callback(rokot_ble_midi_advertising_callback_t callback) {
+  boot.advertising_callback = callback;
+}
+
+// Memory Usage
+void rokot_ble_midi_get_ram_usage(rokot_ble_midi_ram_usage_t *usage) {
+  if (!usage) return;
+
+  usage->tx = (uint32_t)(sizeof(tx_queue) + sizeof(tx_packet) + sizeof(tx_packet_cache) + sizeof(tx_sysex));
+#if ROKOT_BLE_MIDI_MULTICORE
+  usage->tx += (uint32_t)sizeof(core_tx);
+#endif
+
+  usage->rx = (uint32_t)(sizeof(rx_raw) + sizeof(rx_parser) + sizeof(rx_sysex) + sizeof(rx_clock));
+#if RX_DEFERRED
+  usage->rx += (uint32_t)sizeof(rx_queue);
+#endif
+#if ROKOT_BLE_MIDI_RAW_RX_BUFFER
+  usage->rx += (uint32_t)sizeof(rx_raw_ring);
+#endif
+
+  usage->connections = (uint32_t)sizeof(ble_midi_state);
+#if ROKOT_BLE_MIDI_CENTRAL
+  usage->connections += (uint32_t)sizeof(ble_midi_central);
+#endif
+
+  usage->other = (uint32_t)(sizeof(conn_policy) + sizeof(adv_data) + sizeof(scan_resp_data) +
+      sizeof(scan_resp_data_len) + sizeof(adv_schedule) + sizeof(ble_midi_clock));
+#if ROKOT_BLE_MIDI_ENABLE_STATS
+  usage->other += (uint32_t)sizeof(ble_midi_stats);
+#endif
+#if ROKOT_BLE_MIDI_TELEMETRY
+  usage->other += (uint32_t)sizeof(telemetry);
+#endif
+  usage->other += (uint32_t)sizeof(boot);
+#if ROKOT_BLE_MIDI_USB
+  usage->other += (uint32_t)sizeof(usb_bridge);
+#if ROKOT_BLE_MIDI_MULTICORE
+  usage->other += (uint32_t)sizeof(core_usb);
+#endif
+#endif
+
+  usage->total = usage->tx + usage->rx + usage->connections + usage->other;
+  usage->btstack_host_acl = (uint32_t)HCI_HOST_ACL_PACKET_NUM * HCI_HOST_ACL_PACKET_LEN;
+}
@@ -0,0 +1,300 @@
+/**
+ * @file rokot_ble_midi_codec.c
+ * @brief BLE-MIDI packet encoder and decoder
+ */
+
+#include "rokot_ble_midi_codec.h"
+
+#include <string.h>
+
+int rokot_ble_midi_codec_data_len(uint8_t status) {
+  switch (status & 0xF0) {
+  case 0xC0:
+  case 0xD0:
+    return 1;
+  case 0xF0:
+    switch (status) {
+    case 0xF1:
+    case 0xF3:
+      return 1;
+    case 0xF2:
+      return 2;
+    case 0xF6:
+      return 0;
+    default:
+      return (status >= 0xF8) ? 0 : -1;
+    }
+  default:
+    return 2;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Encoder
+// ---------------------------------------------------------------------------
+
+typedef rokot_ble_midi_codec_entry_t entry_t;
+
+static const entry_t *queue_entry(const rokot_ble_midi_codec_queue_t *queue, uint16_t n) {
+  return &queue->entries[(queue->tail + n) % queue->capacity];
+}
+
+// Running status in effect after entry; real-time messages leave it alone
+// and system common messages cancel it
+static uint8_t running_status_after(const entry_t *entry, uint8_t running_status) {
+  if (entry->len == 0) return 0;
+  uint8_t status = entry->data[0];
+  if (status >= 0xF8) return running_status;
+  return (status < 0xF0) ? status : 0;
+}
+
+// Bytes needed to encode a non-SysEx entry after one with prev_timestamp,
+// with running_status in effect (0 at the start of a packet)
+static uint16_t entry_encoded_len(const entry_t *entry, uint16_t prev_timestamp, uint8_t running_status) {
+#if ROKOT_BLE_MIDI_RUNNING_STATUS
+  if (running_status && entry->data[0] == running_status)
+    return (entry->timestamp == prev_timestamp) ? (uint16_t)(entry->len - 1) : entry->len;
+#else
+  (void)prev_timestamp;
+  (void)running_status;
+#endif
+  return (uint16_t)(entry->len + 1);
+}
+
+// Bytes needed for the batch starting at queue position n, or 0 if it is cut
+// short by the end of the queue or contains a SysEx
+static uint16_t group_encoded_len(const rokot_ble_midi_codec_queue_t *queue, uint16_t n,
+                                  uint16_t prev_timestamp, uint8_t running_status) {
+  uint16_t total = 0;
+  while (n < queue->count) {
+    const entry_t *entry = queue_entry(queue, n);
+    if (entry->len == 0) return 0;
+    total = (uint16_t)(total + entry_encoded_len(entry, prev_timestamp, running_status));
+    if (!(entry->flags & ROKOT_BLE_MIDI_CODEC_GROUP_NEXT)) return total;
+    prev_timestamp = entry->timestamp;
+    running_status = running_status_after(entry, running_status);
+    n++;
+  }
+  return 0;
+}
+
+// Packs as many queued messages as fit into max_len bytes without removing
+// them from the queue; *consumed receives the number of messages encoded.
+//
+// The header carries the high 6 bits of the first message's timestamp and
+// every status byte is preceded by a timestamp byte with the low 7 bits.
+// With ROKOT_BLE_MIDI_RUNNING_STATUS a channel message repeating the running
+// status drops its status byte: it is sent as timestamp + data bytes, or as
+// bare data bytes when the timestamp is also unchanged. Running status never
+// carries across packets, is kept through real-time messages and is
+// cancelled by system common messages and SysEx.
+//
+// A SysEx marker streams queue->sysex_data from sysex_offset. Packets that
+// continue a SysEx carry data straight after the header; the progress made is
+// returned in *next_sysex_offset for the caller to commit, 0 once the marker
+// has been consumed.
+//
+// A batch queued with rokot_ble_midi_send_batch() that does not fit in the
+// rest of this packet but would fit in an empty one is held for the next.
+uint16_t rokot_ble_midi_codec_encode(const rokot_ble_midi_codec_queue_t *queue, uint8_t *dst, uint16_t max_len,
+                                     uint16_t start, size_t sysex_offset,
+                                     uint16_t *consumed, size_t *next_sysex_offset) {
+  uint16_t len = 0;
+  uint16_t n = start;
+  uint16_t prev_timestamp = 0;
+  uint8_t running_status = 0;
+  bool in_group = false;
+
+  *next_sysex_offset = sysex_offset;
+
+  while (n < queue->count) {
+    const entry_t *entry = queue_entry(queue, n);
+    uint8_t timestamp_byte = (uint8_t)(0x80 | (entry->timestamp & 0x7F));
+
+    if (len == 0) {
+      dst[len++] = (uint8_t)(0x80 | ((entry->timestamp >> 7) & 0x3F));
+    } else if (((entry->timestamp - prev_timestamp) & 0x1FFF) >= 0x80) {
+      // The receiver only infers a single wrap of the low 7 bits between
+      // consecutive messages; anything older starts a fresh packet
+      break;
+    }
+
+    if (entry->len == 0) {
+      size_t offset = sysex_offset;
+      if (offset == 0) {
+        // Start only with room for a data byte, or for the end of an empty
+        // SysEx, so the start is never sent again in the next packet
+        if (len + (queue->sysex_len ? 3 : 4) > max_len) break;
+        dst[len++] = timestamp_byte;
+        dst[len++] = 0xF0;
+      }
+
+      size_t chunk = queue->sysex_len - offset;
+      if (chunk > (size_t)(max_len - len)) chunk = max_len - len;
+      memcpy(&dst[len], &queue->sysex_data[offset], chunk);
+      len = (uint16_t)(len + chunk);
+      *next_sysex_offset = offset + chunk;
+
+      if (*next_sysex_offset < queue->sysex_len || len + 2 > max_len) break;
+      dst[len++] = timestamp_byte;
+      dst[len++] = 0xF7;
+      *next_sysex_offset = 0;
+
+      prev_timestamp = entry->timestamp;
+      running_status = 0;
+      in_group = false;
+      n++;
+      continue;
+    }
+
+    if (!in_group && (entry->flags & ROKOT_BLE_MIDI_CODEC_GROUP_NEXT) && n > start) {
+      uint16_t group_len = group_encoded_len(queue, n, prev_timestamp, running_status);
+      if (group_len && len + group_len > max_len && 1 + group_encoded_len(queue, n, 0, 0) <= max_len) break;
+    }
+
+    uint16_t needed = entry_encoded_len(entry, prev_timestamp, running_status);
+    if (len + needed > max_len) break;
+
+    if (needed > entry->len) {
+      dst[len++] = timestamp_byte;
+      dst[len++] = entry->data[0];
+    } else if (needed == entry->len) {
+      dst[len++] = timestamp_byte;
+    }
+    memcpy(&dst[len], &entry->data[1], entry->len - 1);
+    len = (uint16_t)(len + entry->len - 1);
+
+    prev_timestamp = entry->timestamp;
+    running_status = running_status_after(entry, running_status);
+    in_group = (entry->flags & ROKOT_BLE_MIDI_CODEC_GROUP_NEXT) != 0;
+    n++;
+  }
+
+  *consumed = (uint16_t)(n - start);
+  return (len > 1) ? len : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Decoder
+// ---------------------------------------------------------------------------
+
+static void decode_error(rokot_ble_midi_decoder_t *decoder) {
+  if (decoder->handlers->error) decoder->handlers->error(decoder->context);
+}
+
+static void decode_emit(rokot_ble_midi_decoder_t *decoder, uint16_t timestamp, uint8_t status, uint8_t data1, uint8_t data2) {
+  if (decoder->handlers->message) decoder->handlers->message(decoder->context, timestamp, status, data1, data2);
+}
+
+static void decode_begin_message(rokot_ble_midi_decoder_t *decoder, uint16_t timestamp, uint8_t status) {
+  decoder->msg[0] = status;
+  decoder->msg_len = 1;
+  decoder->msg_expected = (uint8_t)(rokot_ble_midi_codec_data_len(status) + 1);
+  decoder->msg_timestamp = timestamp;
+}
+
+static void decode_complete_message(rokot_ble_midi_decoder_t *decoder) {
+  decode_emit(decoder, decoder->msg_timestamp, decoder->msg[0],
+      decoder->msg_len > 1 ? decoder->msg[1] : 0, decoder->msg_len > 2 ? decoder->msg[2] : 0);
+  decoder->msg_len = 0;
+}
+
+void rokot_ble_midi_codec_decode(rokot_ble_midi_decoder_t *decoder, const uint8_t *buf, uint16_t len) {
+  const rokot_ble_midi_codec_handlers_t *handlers = decoder->handlers;
+
+  // Header: bit 7 set, bit 6 clear, low 6 bits are timestamp high bits
+  if (len < 2 || (buf[0] & 0xC0) != 0x80) {
+    decode_error(decoder);
+    return;
+  }
+
+  uint16_t timestamp_high = buf[0] & 0x3F;
+  uint16_t timestamp = 0;
+  uint8_t last_low = 0;
+  bool have_timestamp = false;
+
+  // A byte with bit 7 set is a timestamp unless it directly follows one, in
+  // which case it is a status byte. SysEx continuation packets start with data.
+  bool after_timestamp = false;
+
+  decoder->running_status = 0;
+  decoder->msg_len = 0;
+
+  for (uint16_t i = 1; i < len; i++) {
+    uint8_t b = buf[i];
+
+    if (b & 0x80) {
+      if (!after_timestamp) {
+        uint8_t low = b & 0x7F;
+        if (have_timestamp && low < last_low) timestamp_high = (timestamp_high + 1) & 0x3F;
+        last_low = low;
+        have_timestamp = true;
+        timestamp = (uint16_t)((timestamp_high << 7) | low);
+        after_timestamp = true;
+        continue;
+      }
+      after_timestamp = false;
+
+      // Real-time messages may interleave anything, including SysEx and the
+      // data bytes of another message
+      if (b >= 0xF8) {
+        decode_emit(decoder, timestamp, b, 0, 0);
+        continue;
+      }
+
+      // Any other status byte ends a SysEx; only 0xF7 completes it
+      if (decoder->in_sysex) {
+        decoder->in_sysex = false;
+        if (b == 0xF7) {
+          if (handlers->sysex_end) handlers->sysex_end(decoder->context);
+          continue;
+        }
+        decode_error(decoder);
+      }
+
+      if (decoder->msg_len) decode_error(decoder);
+      decoder->msg_len = 0;
+      if (b == 0xF0) {
+        decoder->in_sysex = true;
+        decoder->running_status = 0;
+        if (handlers->sysex_begin) handlers->sysex_begin(decoder->context);
+        continue;
+      }
+
+      int data_len = rokot_ble_midi_codec_data_len(b);
+      if (data_len < 0) {
+        decode_error(decoder);
+        decoder->running_status = 0;
+        continue;
+      }
+
+      // System common messages cancel running status
+      decoder->running_status = (b < 0xF0) ? b : 0;
+      decode_begin_message(decoder, timestamp, b);
+      if (data_len == 0) decode_complete_message(decoder);
+      continue;
+    }
+
+    after_timestamp = false;
+
+    // SysEx data is handed over a run of data bytes at a time
+    if (decoder->in_sysex) {
+      uint16_t end = (uint16_t)(i + 1);
+      while (end < len && !(buf[end] & 0x80)) end++;
+      if (handlers->sysex_data) handlers->sysex_data(decoder->context, &buf[i], (uint16_t)(end - i));
+      i = (uint16_t)(end - 1);
+      continue;
+    }
+
+    if (decoder->msg_len == 0) {
+      if (!decoder->running_status) {
+        decode_error(decoder);
+        continue;
+      }
+      decode_begin_message(decoder, timestamp, decoder->running_status);
+    }
+
+    decoder->msg[decoder->msg_len++] = b;
+    if (decoder->msg_len == decoder->msg_expected) decode_complete_message(decoder);
+  }
+}
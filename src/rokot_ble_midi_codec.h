@@ -0,0 +1,88 @@
+/**
+ * @file rokot_ble_midi_codec.h
+ * @brief BLE-MIDI packet encoder and decoder, free of BTstack and Pico SDK
+ *
+ * Used by rokot_ble_midi.c and built natively by the host tests in tests/.
+ */
+
+#ifndef ROKOT_BLE_MIDI_CODEC_H
+#define ROKOT_BLE_MIDI_CODEC_H
+
+#include "rokot_ble_midi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of data bytes following a status byte, or -1 if undefined
+int rokot_ble_midi_codec_data_len(uint8_t status);
+
+// ---------------------------------------------------------------------------
+// Encoder
+// ---------------------------------------------------------------------------
+
+// The next entry belongs to the same batch and should share its packet
+#define ROKOT_BLE_MIDI_CODEC_GROUP_NEXT 0x01
+
+// One queued message. len is 1-3, or 0 for a marker standing for the SysEx
+// in rokot_ble_midi_codec_queue_t.
+typedef struct {
+  uint16_t timestamp;
+  uint8_t len;
+  uint8_t flags;
+  uint8_t data[3];
+#if ROKOT_BLE_MIDI_ENABLE_STATS
+  uint32_t queued_us;
+#endif
+} rokot_ble_midi_codec_entry_t;
+
+// Ring of entries to encode from: count entries starting at index tail
+typedef struct {
+  const rokot_ble_midi_codec_entry_t *entries;
+  uint16_t capacity;
+  uint16_t tail;
+  uint16_t count;
+  const uint8_t *sysex_data;
+  size_t sysex_len;
+} rokot_ble_midi_codec_queue_t;
+
+uint16_t rokot_ble_midi_codec_encode(const rokot_ble_midi_codec_queue_t *queue, uint8_t *dst, uint16_t max_len,
+                                     uint16_t start, size_t sysex_offset,
+                                     uint16_t *consumed, size_t *next_sysex_offset);
+
+// ---------------------------------------------------------------------------
+// Decoder
+// ---------------------------------------------------------------------------
+
+// Called as a packet is decoded. SysEx data arrives in runs between its
+// begin and end; a SysEx interrupted by another status byte gets no end.
+// Any handler may be NULL.
+typedef struct {
+  void (*message)(void *context, uint16_t timestamp, uint8_t status, uint8_t data1, uint8_t data2);
+  void (*sysex_begin)(void *context);
+  void (*sysex_data)(void *context, const uint8_t *data, uint16_t len);
+  void (*sysex_end)(void *context);
+  void (*error)(void *context);
+} rokot_ble_midi_codec_handlers_t;
+
+// Running status is reset at every packet; an unterminated SysEx carries
+// over in in_sysex, which callers reading from several peers save and
+// restore per peer
+typedef struct {
+  const rokot_ble_midi_codec_handlers_t *handlers;
+  void *context;
+  uint8_t running_status;
+  uint8_t msg[3];
+  uint8_t msg_len;
+  uint8_t msg_expected;
+  uint16_t msg_timestamp;
+  bool in_sysex;
+} rokot_ble_midi_decoder_t;
+
+void rokot_ble_midi_codec_decode(rokot_ble_midi_decoder_t *decoder, const uint8_t *buf, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ROKOT_BLE_MIDI_CODEC_H
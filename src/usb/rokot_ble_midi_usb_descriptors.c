@@ -0,0 +1,103 @@
+/**
+ * @file rokot_ble_midi_usb_descriptors.c
+ * @brief USB descriptors for the RokoT BLE-MIDI USB-MIDI bridge
+ */
+
+#include <string.h>
+
+#include "tusb.h"
+
+#include "rokot_ble_midi.h"
+
+#ifndef ROKOT_BLE_MIDI_USB_VID
+#define ROKOT_BLE_MIDI_USB_VID 0xCAFE
+#endif
+
+#ifndef ROKOT_BLE_MIDI_USB_PID
+#define ROKOT_BLE_MIDI_USB_PID 0x4B4D
+#endif
+
+#ifndef ROKOT_BLE_MIDI_USB_PRODUCT
+#define ROKOT_BLE_MIDI_USB_PRODUCT "RokoT BLE-MIDI Bridge"
+#endif
+
+// ---------------------------------------------------------------------------
+// Device Descriptor
+// ---------------------------------------------------------------------------
+
+static const tusb_desc_device_t desc_device = {
+  .bLength = sizeof(tusb_desc_device_t),
+  .bDescriptorType = TUSB_DESC_DEVICE,
+  .bcdUSB = 0x0200,
+  .bDeviceClass = 0x00,
+  .bDeviceSubClass = 0x00,
+  .bDeviceProtocol = 0x00,
+  .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+  .idVendor = ROKOT_BLE_MIDI_USB_VID,
+  .idProduct = ROKOT_BLE_MIDI_USB_PID,
+  .bcdDevice = 0x0100,
+  .iManufacturer = 0x01,
+  .iProduct = 0x02,
+  .iSerialNumber = 0x00,
+  .bNumConfigurations = 0x01,
+};
+
+const uint8_t *tud_descriptor_device_cb(void) {
+  return (const uint8_t *)&desc_device;
+}
+
+// ---------------------------------------------------------------------------
+// Configuration Descriptor
+// ---------------------------------------------------------------------------
+
+#define ITF_NUM_MIDI 0
+#define ITF_NUM_MIDI_STREAMING 1
+#define ITF_NUM_TOTAL 2
+
+#define EPNUM_MIDI_OUT 0x01
+#define EPNUM_MIDI_IN 0x81
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_MIDI_DESC_LEN)
+
+static const uint8_t desc_configuration[] = {
+  TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
+  TUD_MIDI_DESCRIPTOR(ITF_NUM_MIDI, 0, EPNUM_MIDI_OUT, EPNUM_MIDI_IN, 64),
+};
+
+const uint8_t *tud_descriptor_configuration_cb(uint8_t index) {
+  (void)index;
+  return desc_configuration;
+}
+
+// ---------------------------------------------------------------------------
+// String Descriptors
+// ---------------------------------------------------------------------------
+
+static const char *const string_desc[] = {
+  NULL,  // Language ID, filled in below
+  ROKOT_BLE_MIDI_MANUFACTURER,
+  ROKOT_BLE_MIDI_USB_PRODUCT,
+};
+
+static uint16_t desc_str[32];
+
+const uint16_t *tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+  (void)langid;
+  uint8_t chr_count;
+
+  if (index == 0) {
+    desc_str[1] = 0x0409;  // English (United States)
+    chr_count = 1;
+  } else {
+    if (index >= sizeof(string_desc) / sizeof(string_desc[0])) return NULL;
+    const char *str = string_desc[index];
+    size_t len = strlen(str);
+    if (len > 31) len = 31;
+    for (size_t i = 0; i < len; i++) desc_str[1 + i] = (uint8_t)str[i];
+    chr_count = (uint8_t)len;
+  }
+
+  // First entry is the length (in bytes) and descriptor type
+  desc_str[0] = (uint16_t)((TUSB_DESC_STRING << 8) | (2 * chr_count + 2));
+  return desc_str;
+}
@@ -0,0 +1,28 @@
+#ifndef ROKOT_BLE_MIDI_TUSB_CONFIG_H
+#define ROKOT_BLE_MIDI_TUSB_CONFIG_H
+
+// ---------------------------------------------------------------------------
+// RokoT BLE-MIDI TinyUSB Configuration (USB-MIDI bridge)
+// ---------------------------------------------------------------------------
+
+// Device mode on the RP2040/RP2350 native USB port
+#define CFG_TUSB_RHPORT0_MODE (OPT_MODE_DEVICE | OPT_MODE_FULL_SPEED)
+
+#ifndef CFG_TUSB_OS
+#define CFG_TUSB_OS OPT_OS_PICO
+#endif
+
+#define CFG_TUD_ENDPOINT0_SIZE 64
+
+// MIDI only; USB stdio cannot be used alongside the bridge
+#define CFG_TUD_CDC 0
+#define CFG_TUD_MSC 0
+#define CFG_TUD_HID 0
+#define CFG_TUD_VENDOR 0
+#define CFG_TUD_MIDI 1
+
+// Room for a full BLE-MIDI notification's worth of events between tud_task() calls
+#define CFG_TUD_MIDI_RX_BUFSIZE 256
+#define CFG_TUD_MIDI_TX_BUFSIZE 256
+
+#endif // ROKOT_BLE_MIDI_TUSB_CONFIG_H
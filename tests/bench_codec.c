@@ -0,0 +1,104 @@
+/**
+ * @file bench_codec.c
+ * @brief Encode/decode cost per message on the host
+ *
+ * Fills a full queue with a mix of channel and real-time messages, encodes it
+ * into MTU-sized packets and decodes those packets again, reporting
+ * nanoseconds per message for each direction. Absolute figures are for the
+ * host CPU; compare runs on the same machine to spot regressions.
+ *
+ *   bench_codec [iterations] [packet bytes]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "rokot_ble_midi_codec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define QUEUE_LEN 64
+#define PACKETS_MAX QUEUE_LEN
+
+static rokot_ble_midi_codec_entry_t entries[QUEUE_LEN];
+static uint8_t packets[PACKETS_MAX][512];
+static uint16_t packet_lens[PACKETS_MAX];
+static volatile uint32_t sink;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void on_message(void *context, uint16_t timestamp, uint8_t status, uint8_t data1, uint8_t data2) {
+  (void)context;
+  sink += (uint32_t)(timestamp + status + data1 + data2);
+}
+
+static void fill_queue(void) {
+  srand(1);
+  uint16_t timestamp = 0;
+  for (int i = 0; i < QUEUE_LEN; i++) {
+    rokot_ble_midi_codec_entry_t *entry = &entries[i];
+    if (i % 3 == 0) timestamp = (uint16_t)((timestamp + 1) & 0x1FFF);
+    entry->timestamp = timestamp;
+    entry->flags = 0;
+    if (i % 16 == 15) {
+      entry->data[0] = 0xF8;
+      entry->len = 1;
+    } else {
+      entry->data[0] = (i % 4 == 3) ? 0xB0 : 0x90;
+      entry->data[1] = (uint8_t)(rand() & 0x7F);
+      entry->data[2] = (uint8_t)(rand() & 0x7F);
+      entry->len = 3;
+    }
+  }
+}
+
+// Encodes the whole queue; returns the number of packets
+static int encode_all(const rokot_ble_midi_codec_queue_t *queue, uint16_t max_len) {
+  int n = 0;
+  uint16_t start = 0;
+  while (start < queue->count && n < PACKETS_MAX) {
+    uint16_t consumed;
+    size_t next;
+    packet_lens[n] = rokot_ble_midi_codec_encode(queue, packets[n], max_len, start, 0, &consumed, &next);
+    start = (uint16_t)(start + consumed);
+    n++;
+  }
+  return n;
+}
+
+int main(int argc, char **argv) {
+  long iterations = (argc > 1) ? atol(argv[1]) : 20000;
+  long packet_bytes = (argc > 2) ? atol(argv[2]) : 20;
+  if (iterations < 1) iterations = 1;
+  if (packet_bytes < 8) packet_bytes = 8;
+  if (packet_bytes > 512) packet_bytes = 512;
+  uint16_t max_len = (uint16_t)packet_bytes;
+
+  fill_queue();
+  const rokot_ble_midi_codec_queue_t queue = {.entries = entries, .capacity = QUEUE_LEN, .count = QUEUE_LEN};
+  static const rokot_ble_midi_codec_handlers_t handlers = {.message = on_message};
+  rokot_ble_midi_decoder_t decoder = {.handlers = &handlers};
+
+  int packet_count = 0;
+  uint64_t t0 = now_ns();
+  for (long i = 0; i < iterations; i++) packet_count = encode_all(&queue, max_len);
+  uint64_t t1 = now_ns();
+  for (long i = 0; i < iterations; i++)
+    for (int p = 0; p < packet_count; p++) rokot_ble_midi_codec_decode(&decoder, packets[p], packet_lens[p]);
+  uint64_t t2 = now_ns();
+
+  uint32_t bytes = 0;
+  for (int p = 0; p < packet_count; p++) bytes += packet_lens[p];
+  double messages = (double)iterations * QUEUE_LEN;
+
+  printf("%d messages -> %d packets of <= %u bytes (%u bytes, running status %s)\n", QUEUE_LEN, packet_count,
+      (unsigned)max_len, (unsigned)bytes, ROKOT_BLE_MIDI_RUNNING_STATUS ? "on" : "off");
+  printf("encode: %.1f ns/message\n", (double)(t1 - t0) / messages);
+  printf("decode: %.1f ns/message\n", (double)(t2 - t1) / messages);
+  return 0;
+}
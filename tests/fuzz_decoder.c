@@ -0,0 +1,76 @@
+/**
+ * @file fuzz_decoder.c
+ * @brief libFuzzer target for the BLE-MIDI packet decoder
+ *
+ * The first byte of each input sets the packet length the rest is split
+ * into, so SysEx continuation is exercised across packet boundaries as on a
+ * real link. Decoded output is checked against the invariants the library
+ * relies on.
+ */
+
+#include "rokot_ble_midi_codec.h"
+
+#include <stdlib.h>
+
+static struct {
+  bool in_sysex;
+} fuzz;
+
+static void on_message(void *context, uint16_t timestamp, uint8_t status, uint8_t data1, uint8_t data2) {
+  (void)context;
+  if (timestamp > 0x1FFF || !(status & 0x80) || status == 0xF0 || status == 0xF7 ||
+      rokot_ble_midi_codec_data_len(status) < 0 || (data1 & 0x80) || (data2 & 0x80))
+    abort();
+}
+
+static void on_sysex_begin(void *context) {
+  (void)context;
+  fuzz.in_sysex = true;
+}
+
+static void on_sysex_data(void *context, const uint8_t *data, uint16_t len) {
+  (void)context;
+  if (!fuzz.in_sysex || len == 0) abort();
+  for (uint16_t i = 0; i < len; i++)
+    if (data[i] & 0x80) abort();
+}
+
+static void on_sysex_end(void *context) {
+  (void)context;
+  if (!fuzz.in_sysex) abort();
+  fuzz.in_sysex = false;
+}
+
+static void on_error(void *context) {
+  (void)context;
+}
+
+static const rokot_ble_midi_codec_handlers_t handlers = {
+    .message = on_message,
+    .sysex_begin = on_sysex_begin,
+    .sysex_data = on_sysex_data,
+    .sysex_end = on_sysex_end,
+    .error = on_error,
+};
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (size < 1) return 0;
+  size_t packet_len = (size_t)(data[0] % 32) + 1;
+  data++;
+  size--;
+
+  rokot_ble_midi_decoder_t decoder = {.handlers = &handlers};
+  fuzz.in_sysex = false;
+
+  while (size) {
+    size_t len = (size < packet_len) ? size : packet_len;
+    rokot_ble_midi_codec_decode(&decoder, data, (uint16_t)len);
+    // Open SysEx state only ever comes from a begin; one abandoned for
+    // another status byte gets no end
+    if (decoder.in_sysex && !fuzz.in_sysex) abort();
+    fuzz.in_sysex = decoder.in_sysex;
+    data += len;
+    size -= len;
+  }
+  return 0;
+}
@@ -0,0 +1,502 @@
+/**
+ * @file test_codec.c
+ * @brief Host tests for the BLE-MIDI packet encoder and decoder
+ */
+
+#include "rokot_ble_midi_codec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+
+#define CHECK(cond)                                                       \
+  do {                                                                    \
+    if (!(cond)) {                                                        \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++;                                                         \
+    }                                                                     \
+  } while (0)
+
+#define CHECK_BYTES(actual, actual_len, ...)                              \
+  do {                                                                    \
+    const uint8_t expected_[] = {__VA_ARGS__};                            \
+    CHECK((actual_len) == sizeof(expected_));                             \
+    CHECK(memcmp((actual), expected_, sizeof(expected_)) == 0);           \
+  } while (0)
+
+// ---------------------------------------------------------------------------
+// Encoder Helpers
+// ---------------------------------------------------------------------------
+
+#define QUEUE_LEN 64
+
+static rokot_ble_midi_codec_entry_t entries[QUEUE_LEN];
+static rokot_ble_midi_codec_queue_t queue;
+
+static void queue_reset(void) {
+  memset(entries, 0, sizeof(entries));
+  queue = (rokot_ble_midi_codec_queue_t){.entries = entries, .capacity = QUEUE_LEN};
+}
+
+static void queue_push(uint16_t timestamp, uint8_t flags, uint8_t status, uint8_t data1, uint8_t data2) {
+  rokot_ble_midi_codec_entry_t *entry = &entries[(queue.tail + queue.count) % QUEUE_LEN];
+  entry->timestamp = timestamp;
+  entry->len = (uint8_t)(rokot_ble_midi_codec_data_len(status) + 1);
+  entry->flags = flags;
+  entry->data[0] = status;
+  entry->data[1] = data1;
+  entry->data[2] = data2;
+  queue.count++;
+}
+
+static void queue_push_sysex(uint16_t timestamp, const uint8_t *data, size_t len) {
+  rokot_ble_midi_codec_entry_t *entry = &entries[(queue.tail + queue.count) % QUEUE_LEN];
+  memset(entry, 0, sizeof(*entry));
+  entry->timestamp = timestamp;
+  queue.sysex_data = data;
+  queue.sysex_len = len;
+  queue.count++;
+}
+
+// ---------------------------------------------------------------------------
+// Decoder Helpers
+// ---------------------------------------------------------------------------
+
+typedef struct {
+  uint16_t timestamp;
+  uint8_t status;
+  uint8_t data1;
+  uint8_t data2;
+} message_t;
+
+static struct {
+  message_t messages[256];
+  int count;
+  uint8_t sysex[1024];
+  size_t sysex_len;
+  int sysex_begins;
+  int sysex_ends;
+  int errors;
+} rx;
+
+static void on_message(void *context, uint16_t timestamp, uint8_t status, uint8_t data1, uint8_t data2) {
+  (void)context;
+  if (rx.count < 256) rx.messages[rx.count++] = (message_t){timestamp, status, data1, data2};
+}
+
+static void on_sysex_begin(void *context) {
+  (void)context;
+  rx.sysex_begins++;
+  rx.sysex_len = 0;
+}
+
+static void on_sysex_data(void *context, const uint8_t *data, uint16_t len) {
+  (void)context;
+  for (uint16_t i = 0; i < len; i++)
+    if (rx.sysex_len < sizeof(rx.sysex)) rx.sysex[rx.sysex_len++] = data[i];
+}
+
+static void on_sysex_end(void *context) {
+  (void)context;
+  rx.sysex_ends++;
+}
+
+static void on_error(void *context) {
+  (void)context;
+  rx.errors++;
+}
+
+static const rokot_ble_midi_codec_handlers_t handlers = {
+    .message = on_message,
+    .sysex_begin = on_sysex_begin,
+    .sysex_data = on_sysex_data,
+    .sysex_end = on_sysex_end,
+    .error = on_error,
+};
+
+static rokot_ble_midi_decoder_t decoder;
+
+static void rx_reset(void) {
+  memset(&rx, 0, sizeof(rx));
+  decoder = (rokot_ble_midi_decoder_t){.handlers = &handlers};
+}
+
+static void decode(const uint8_t *buf, uint16_t len) {
+  rokot_ble_midi_codec_decode(&decoder, buf, len);
+}
+
+#define DECODE(...)                                     \
+  do {                                                  \
+    const uint8_t packet_[] = {__VA_ARGS__};            \
+    decode(packet_, (uint16_t)sizeof(packet_));         \
+  } while (0)
+
+static bool message_is(int i, uint16_t timestamp, uint8_t status, uint8_t data1, uint8_t data2) {
+  if (i >= rx.count) return false;
+  const message_t *m = &rx.messages[i];
+  return m->timestamp == timestamp && m->status == status && m->data1 == data1 && m->data2 == data2;
+}
+
+// ---------------------------------------------------------------------------
+// Encoder Tests
+// ---------------------------------------------------------------------------
+
+static void test_data_len(void) {
+  CHECK(rokot_ble_midi_codec_data_len(0x90) == 2);
+  CHECK(rokot_ble_midi_codec_data_len(0xB5) == 2);
+  CHECK(rokot_ble_midi_codec_data_len(0xC0) == 1);
+  CHECK(rokot_ble_midi_codec_data_len(0xDF) == 1);
+  CHECK(rokot_ble_midi_codec_data_len(0xE0) == 2);
+  CHECK(rokot_ble_midi_codec_data_len(0xF1) == 1);
+  CHECK(rokot_ble_midi_codec_data_len(0xF2) == 2);
+  CHECK(rokot_ble_midi_codec_data_len(0xF3) == 1);
+  CHECK(rokot_ble_midi_codec_data_len(0xF6) == 0);
+  CHECK(rokot_ble_midi_codec_data_len(0xF8) == 0);
+  CHECK(rokot_ble_midi_codec_data_len(0xFF) == 0);
+  CHECK(rokot_ble_midi_codec_data_len(0xF0) == -1);
+  CHECK(rokot_ble_midi_codec_data_len(0xF4) == -1);
+  CHECK(rokot_ble_midi_codec_data_len(0xF7) == -1);
+}
+
+static void test_encode_single(void) {
+  uint8_t out[32];
+  uint16_t consumed;
+  size_t next;
+
+  queue_reset();
+  queue_push(0x1234 & 0x1FFF, 0, 0x90, 60, 100);
+  uint16_t len = rokot_ble_midi_codec_encode(&queue, out, sizeof(out), 0, 0, &consumed, &next);
+  CHECK(consumed == 1);
+  CHECK(next == 0);
+  CHECK_BYTES(out, len, 0x80 | ((0x1234 >> 7) & 0x3F), 0x80 | (0x1234 & 0x7F), 0x90, 60, 100);
+
+  // Nothing to send from the end of the queue
+  len = rokot_ble_midi_codec_encode(&queue, out, sizeof(out), 1, 0, &consumed, &next);
+  CHECK(len == 0);
+  CHECK(consumed == 0);
+}
+
+static void test_encode_running_status(void) {
+  uint8_t out[32];
+  uint16_t consumed;
+  size_t next;
+
+  queue_reset();
+  queue_push(10, 0, 0x90, 60, 100);
+  queue_push(10, 0, 0x90, 64, 100);
+  queue_push(11, 0, 0x90, 67, 100);
+  queue_push(11, 0, 0xF8, 0, 0);
+  queue_push(11, 0, 0x90, 72, 100);
+  queue_push(11, 0, 0xF1, 5, 0);
+  queue_push(11, 0, 0x90, 76, 100);
+  uint16_t len = rokot_ble_midi_codec_encode(&queue, out, sizeof(out), 0, 0, &consumed, &next);
+  CHECK(consumed == 7);
+#if ROKOT_BLE_MIDI_RUNNING_STATUS
+  // Same timestamp: bare data. New timestamp: timestamp + data. Real-time
+  // keeps running status, system common cancels it.
+  CHECK_BYTES(out, len, 0x80, 0x8A, 0x90, 60, 100, 64, 100, 0x8B, 67, 100, 0x8B, 0xF8, 72, 100,
+      0x8B, 0xF1, 5, 0x8B, 0x90, 76, 100);
+#else
+  CHECK_BYTES(out, len, 0x80, 0x8A, 0x90, 60, 100, 0x8A, 0x90, 64, 100, 0x8B, 0x90, 67, 100, 0x8B, 0xF8,
+      0x8B, 0x90, 72, 100, 0x8B, 0xF1, 5, 0x8B, 0x90, 76, 100);
+#endif
+}
+
+static void test_encode_limits(void) {
+  uint8_t out[32];
+  uint16_t consumed;
+  size_t next;
+
+  // A timestamp 128 ms or more after the previous message starts a new packet
+  queue_reset();
+  queue_push(0x1FF0, 0, 0x90, 60, 100);
+  queue_push(0x0060, 0, 0x80, 60, 0);
+  queue_push(0x0070, 0, 0x80, 61, 0);
+  rokot_ble_midi_codec_encode(&queue, out, sizeof(out), 0, 0, &consumed, &next);
+  CHECK(consumed == 3);
+  queue.count = 0;
+  queue_push(0x0000, 0, 0x90, 60, 100);
+  queue_push(0x0080, 0, 0x80, 60, 0);
+  rokot_ble_midi_codec_encode(&queue, out, sizeof(out), 0, 0, &consumed, &next);
+  CHECK(consumed == 1);
+
+  // Only whole messages fit
+  queue_reset();
+  queue_push(0, 0, 0x90, 60, 100);
+  queue_push(0, 0, 0xC0, 1, 0);
+  uint16_t len = rokot_ble_midi_codec_encode(&queue, out, 7, 0, 0, &consumed, &next);
+  CHECK(consumed == 1);
+  CHECK(len == 5);
+
+  // Entries wrap around the end of the ring
+  queue_reset();
+  queue.tail = QUEUE_LEN - 1;
+  queue_push(0, 0, 0x90, 60, 100);
+  queue_push(0, 0, 0xC0, 7, 0);
+  len = rokot_ble_midi_codec_encode(&queue, out, sizeof(out), 0, 0, &consumed, &next);
+  CHECK(consumed == 2);
+  CHECK_BYTES(out, len, 0x80, 0x80, 0x90, 60, 100, 0x80, 0xC0, 7);
+}
+
+static void test_encode_group(void) {
+  uint8_t out[32];
+  uint16_t consumed;
+  size_t next;
+
+  // A batch that does not fit behind the first message waits for the next
+  // packet, where it fits whole
+  queue_reset();
+  queue_push(0, 0, 0x80, 1, 0);
+  for (int i = 0; i < 4; i++) queue_push(0, (i < 3) ? ROKOT_BLE_MIDI_CODEC_GROUP_NEXT : 0, (uint8_t)(0xB0 + i), 7, 0);
+  uint16_t len = rokot_ble_midi_codec_encode(&queue, out, 18, 0, 0, &consumed, &next);
+  CHECK(consumed == 1);
+  CHECK(len == 5);
+  len = rokot_ble_midi_codec_encode(&queue, out, 18, 1, 0, &consumed, &next);
+  CHECK(consumed == 4);
+  CHECK(len == 17);
+
+  // One that would not fit even an empty packet is split instead
+  len = rokot_ble_midi_codec_encode(&queue, out, 12, 0, 0, &consumed, &next);
+  CHECK(consumed == 2);
+}
+
+static void test_encode_sysex(void) {
+  uint8_t sysex[40];
+  uint8_t out[20];
+  uint16_t consumed;
+  size_t next;
+  for (size_t i = 0; i < sizeof(sysex); i++) sysex[i] = (uint8_t)i;
+
+  queue_reset();
+  queue_push(5, 0, 0x90, 60, 100);
+  queue_push_sysex(6, sysex, sizeof(sysex));
+  queue_push(7, 0, 0x80, 60, 0);
+
+  rx_reset();
+  uint16_t start = 0;
+  size_t offset = 0;
+  int packets = 0;
+  while (start < queue.count) {
+    uint16_t len = rokot_ble_midi_codec_encode(&queue, out, sizeof(out), start, offset, &consumed, &next);
+    CHECK(len > 0 && len <= sizeof(out));
+    if (packets == 0) CHECK(out[2] == 0x90);
+    if (packets == 1) CHECK(!(out[1] & 0x80));
+    decode(out, len);
+    start = (uint16_t)(start + consumed);
+    offset = next;
+    if (++packets > 10) break;
+  }
+  CHECK(packets == 3);
+  CHECK(rx.count == 2);
+  CHECK(message_is(0, 5, 0x90, 60, 100));
+  CHECK(message_is(1, 7, 0x80, 60, 0));
+  CHECK(rx.sysex_begins == 1);
+  CHECK(rx.sysex_ends == 1);
+  CHECK(rx.sysex_len == sizeof(sysex));
+  CHECK(memcmp(rx.sysex, sysex, sizeof(sysex)) == 0);
+  CHECK(rx.errors == 0);
+
+  // Messages leave room for the SysEx start only (and for an empty SysEx,
+  // not for its end); the start moves to the next packet instead
+  static const uint8_t short_sysex[] = {1, 2, 3};
+  static const struct {
+    const uint8_t *data;
+    size_t len;
+    uint16_t max_len;
+  } boundaries[] = {{short_sysex, sizeof(short_sysex), 22}, {short_sysex, 0, 23}};
+  for (size_t b = 0; b < sizeof(boundaries) / sizeof(boundaries[0]); b++) {
+    uint8_t packet[32];
+    queue_reset();
+    for (uint8_t i = 0; i < 4; i++) queue_push(5, 0, (uint8_t)(0x90 + i), 60, 100);
+    queue_push(5, 0, 0xC0, 1, 0);
+    queue_push_sysex(5, boundaries[b].data, boundaries[b].len);
+
+    rx_reset();
+    start = 0;
+    offset = 0;
+    packets = 0;
+    while (start < queue.count) {
+      uint16_t len = rokot_ble_midi_codec_encode(&queue, packet, boundaries[b].max_len, start, offset,
+          &consumed, &next);
+      CHECK(len > 0 && len <= boundaries[b].max_len);
+      if (packets == 0) CHECK(len == 20 && consumed == 5);
+      decode(packet, len);
+      start = (uint16_t)(start + consumed);
+      offset = next;
+      if (++packets > 10) break;
+    }
+    CHECK(packets == 2);
+    CHECK(rx.count == 5);
+    CHECK(rx.sysex_begins == 1);
+    CHECK(rx.sysex_ends == 1);
+    CHECK(rx.sysex_len == boundaries[b].len);
+    CHECK(rx.errors == 0);
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Decoder Tests
+// ---------------------------------------------------------------------------
+
+static void test_decode_running_status(void) {
+  rx_reset();
+  // Bare data, timestamp + data, real-time between data bytes
+  DECODE(0x81, 0x82, 0x90, 60, 100, 64, 100, 0x83, 67, 0x83, 0xF8, 100);
+  CHECK(rx.count == 4);
+  CHECK(message_is(0, 0x82, 0x90, 60, 100));
+  CHECK(message_is(1, 0x82, 0x90, 64, 100));
+  CHECK(message_is(2, 0x83, 0xF8, 0, 0));
+  CHECK(message_is(3, 0x83, 0x90, 67, 100));
+  CHECK(rx.errors == 0);
+
+  // Running status does not carry over into the next packet
+  DECODE(0x81, 60);
+  CHECK(rx.count == 4);
+  CHECK(rx.errors == 1);
+}
+
+static void test_decode_timestamp_wrap(void) {
+  rx_reset();
+  DECODE(0x85, 0xFE, 0xC0, 1, 0x82, 0xC0, 2);
+  CHECK(rx.count == 2);
+  CHECK(message_is(0, (5 << 7) | 0x7E, 0xC0, 1, 0));
+  CHECK(message_is(1, (6 << 7) | 0x02, 0xC0, 2, 0));
+
+  // The high bits wrap at 13 bits
+  rx_reset();
+  DECODE(0xBF, 0xFF, 0xF8, 0x80, 0xF8);
+  CHECK(message_is(0, 0x1FFF, 0xF8, 0, 0));
+  CHECK(message_is(1, 0x0000, 0xF8, 0, 0));
+}
+
+static void test_decode_sysex(void) {
+  // Real-time inside SysEx
+  rx_reset();
+  DECODE(0x80, 0x80, 0xF0, 1, 2, 0x81, 0xF8, 3, 0x82, 0xF7);
+  CHECK(rx.count == 1);
+  CHECK(message_is(0, 1, 0xF8, 0, 0));
+  CHECK(rx.sysex_ends == 1);
+  CHECK(rx.sysex_len == 3);
+  CHECK(rx.sysex[2] == 3);
+
+  // Continuation packet, then a new status byte abandons an open SysEx
+  rx_reset();
+  DECODE(0x80, 0x80, 0xF0, 1, 2);
+  CHECK(decoder.in_sysex);
+  DECODE(0x80, 3, 4, 0x81, 0xF7);
+  CHECK(!decoder.in_sysex);
+  CHECK(rx.sysex_len == 4);
+  CHECK(rx.sysex_ends == 1);
+  DECODE(0x80, 0x80, 0xF0, 1, 0x81, 0x90, 60, 100);
+  CHECK(rx.sysex_begins == 2);
+  CHECK(rx.sysex_ends == 1);
+  CHECK(rx.errors == 1);
+  CHECK(message_is(0, 1, 0x90, 60, 100));
+}
+
+static void test_decode_malformed(void) {
+  rx_reset();
+
+  // Bad header, too short
+  DECODE(0x40, 0x80, 0xF8);
+  DECODE(0x80);
+  decode(NULL, 0);
+  CHECK(rx.errors == 3);
+
+  // Undefined status byte, then data with no status to run on
+  DECODE(0x80, 0x80, 0xF4, 1);
+  CHECK(rx.errors == 5);
+
+  // Incomplete message cut short by another status
+  DECODE(0x80, 0x80, 0x90, 60, 0x80, 0xC0, 1);
+  CHECK(rx.errors == 6);
+  CHECK(rx.count == 1);
+  CHECK(message_is(0, 0, 0xC0, 1, 0));
+
+  // Stray F7 outside SysEx
+  DECODE(0x80, 0x80, 0xF7);
+  CHECK(rx.errors == 7);
+  CHECK(rx.count == 1);
+
+  // Handlers may be left out
+  static const rokot_ble_midi_codec_handlers_t none = {0};
+  rokot_ble_midi_decoder_t quiet = {.handlers = &none};
+  const uint8_t packet[] = {0x80, 0x80, 0xF0, 1, 0x80, 0xF7, 0x80, 0x90, 1, 2, 0x40};
+  rokot_ble_midi_codec_decode(&quiet, packet, sizeof(packet));
+}
+
+// ---------------------------------------------------------------------------
+// Round Trip
+// ---------------------------------------------------------------------------
+
+static uint8_t random_status(void) {
+  static const uint8_t system[] = {0xF1, 0xF2, 0xF3, 0xF6, 0xF8, 0xFA, 0xFB, 0xFC, 0xFE, 0xFF};
+  if (rand() % 8 == 0) return system[rand() % (int)sizeof(system)];
+  // Few statuses so running status comes up often
+  return (uint8_t)(0x80 + (rand() % 7) * 0x10 + (rand() % 2));
+}
+
+static void test_round_trip(void) {
+  srand(1);
+  for (int round = 0; round < 200; round++) {
+    queue_reset();
+    rx_reset();
+
+    message_t sent[QUEUE_LEN];
+    uint16_t timestamp = (uint16_t)(rand() & 0x1FFF);
+    int n = 1 + rand() % (QUEUE_LEN - 1);
+    queue.tail = (uint16_t)(rand() % QUEUE_LEN);
+    for (int i = 0; i < n; i++) {
+      timestamp = (uint16_t)((timestamp + rand() % 3 * (rand() % 2 ? 1 : 70)) & 0x1FFF);
+      uint8_t status = random_status();
+      int data_len = rokot_ble_midi_codec_data_len(status);
+      uint8_t data1 = data_len > 0 ? (uint8_t)(rand() & 0x7F) : 0;
+      uint8_t data2 = data_len > 1 ? (uint8_t)(rand() & 0x7F) : 0;
+      uint8_t flags = (rand() % 4 == 0 && i + 1 < n) ? ROKOT_BLE_MIDI_CODEC_GROUP_NEXT : 0;
+      queue_push(timestamp, flags, status, data1, data2);
+      sent[i] = (message_t){timestamp, status, data1, data2};
+    }
+
+    uint16_t max_len = (uint16_t)(8 + rand() % 240);
+    uint8_t out[256];
+    uint16_t start = 0;
+    while (start < queue.count) {
+      uint16_t consumed;
+      size_t next;
+      uint16_t len = rokot_ble_midi_codec_encode(&queue, out, max_len, start, 0, &consumed, &next);
+      CHECK(consumed > 0);
+      CHECK(len <= max_len);
+      if (!consumed) break;
+      decode(out, len);
+      start = (uint16_t)(start + consumed);
+    }
+
+    CHECK(rx.count == n);
+    CHECK(rx.errors == 0);
+    for (int i = 0; i < n && i < rx.count; i++)
+      CHECK(message_is(i, sent[i].timestamp, sent[i].status, sent[i].data1, sent[i].data2));
+  }
+}
+
+int main(void) {
+  test_data_len();
+  test_encode_single();
+  test_encode_running_status();
+  test_encode_limits();
+  test_encode_group();
+  test_encode_sysex();
+  test_decode_running_status();
+  test_decode_timestamp_wrap();
+  test_decode_sysex();
+  test_decode_malformed();
+  test_round_trip();
+
+  if (failures) {
+    fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("All codec tests passed\n");
+  return 0;
+}